@@ -6,28 +6,137 @@
 using namespace Rcpp;
 
 // select_controls_cpp
-List select_controls_cpp(NumericMatrix& gmatrix, NumericVector& residuals, NumericMatrix& cc, NumericVector& chi2fn, NumericVector min_lambda, NumericVector lb_lambda, NumericVector max_lambda, NumericVector ub_lambda, IntegerVector min, IntegerVector bin_size);
-RcppExport SEXP _SVDFunctions_select_controls_cpp(SEXP gmatrixSEXP, SEXP residualsSEXP, SEXP ccSEXP, SEXP chi2fnSEXP, SEXP min_lambdaSEXP, SEXP lb_lambdaSEXP, SEXP max_lambdaSEXP, SEXP ub_lambdaSEXP, SEXP minSEXP, SEXP bin_sizeSEXP) {
+List select_controls_cpp(SEXP gmatrix, NumericVector& residuals, NumericMatrix& cc, NumericVector min_lambda, NumericVector lb_lambda, NumericVector max_lambda, NumericVector ub_lambda, IntegerVector min, IntegerVector bin_size, IntegerVector threads, IntegerVector snapshot_step, LogicalVector adaptive);
+RcppExport SEXP _SVDFunctions_select_controls_cpp(SEXP gmatrixSEXP, SEXP residualsSEXP, SEXP ccSEXP, SEXP min_lambdaSEXP, SEXP lb_lambdaSEXP, SEXP max_lambdaSEXP, SEXP ub_lambdaSEXP, SEXP minSEXP, SEXP bin_sizeSEXP, SEXP threadsSEXP, SEXP snapshot_stepSEXP, SEXP adaptiveSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix& >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
     Rcpp::traits::input_parameter< NumericVector& >::type residuals(residualsSEXP);
     Rcpp::traits::input_parameter< NumericMatrix& >::type cc(ccSEXP);
-    Rcpp::traits::input_parameter< NumericVector& >::type chi2fn(chi2fnSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type min_lambda(min_lambdaSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type lb_lambda(lb_lambdaSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type max_lambda(max_lambdaSEXP);
     Rcpp::traits::input_parameter< NumericVector >::type ub_lambda(ub_lambdaSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type min(minSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type bin_size(bin_sizeSEXP);
-    rcpp_result_gen = Rcpp::wrap(select_controls_cpp(gmatrix, residuals, cc, chi2fn, min_lambda, lb_lambda, max_lambda, ub_lambda, min, bin_size));
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type snapshot_step(snapshot_stepSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type adaptive(adaptiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(select_controls_cpp(gmatrix, residuals, cc, min_lambda, lb_lambda, max_lambda, ub_lambda, min, bin_size, threads, snapshot_step, adaptive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// select_controls_batch_cpp
+List select_controls_batch_cpp(SEXP gmatrix, List bases, IntegerVector n_sv, List cc, NumericVector min_lambda, NumericVector lb_lambda, NumericVector max_lambda, NumericVector ub_lambda, IntegerVector min, IntegerVector bin_size, IntegerVector threads, IntegerVector snapshot_step, LogicalVector adaptive);
+RcppExport SEXP _SVDFunctions_select_controls_batch_cpp(SEXP gmatrixSEXP, SEXP basesSEXP, SEXP n_svSEXP, SEXP ccSEXP, SEXP min_lambdaSEXP, SEXP lb_lambdaSEXP, SEXP max_lambdaSEXP, SEXP ub_lambdaSEXP, SEXP minSEXP, SEXP bin_sizeSEXP, SEXP threadsSEXP, SEXP snapshot_stepSEXP, SEXP adaptiveSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< List >::type bases(basesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type n_sv(n_svSEXP);
+    Rcpp::traits::input_parameter< List >::type cc(ccSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type min_lambda(min_lambdaSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type lb_lambda(lb_lambdaSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type max_lambda(max_lambdaSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type ub_lambda(ub_lambdaSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type min(minSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type bin_size(bin_sizeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type snapshot_step(snapshot_stepSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type adaptive(adaptiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(select_controls_batch_cpp(gmatrix, bases, n_sv, cc, min_lambda, lb_lambda, max_lambda, ub_lambda, min, bin_size, threads, snapshot_step, adaptive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// residual_norms_cpp
+NumericMatrix residual_norms_cpp(SEXP gmatrix, NumericMatrix& u, IntegerVector n_sv, IntegerVector threads);
+RcppExport SEXP _SVDFunctions_residual_norms_cpp(SEXP gmatrixSEXP, SEXP uSEXP, SEXP n_svSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix& >::type u(uSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type n_sv(n_svSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(residual_norms_cpp(gmatrix, u, n_sv, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// predict_ancestry_cpp
+IntegerVector predict_ancestry_cpp(SEXP gmatrix, List bases, IntegerVector n_sv, IntegerVector threads);
+RcppExport SEXP _SVDFunctions_predict_ancestry_cpp(SEXP gmatrixSEXP, SEXP basesSEXP, SEXP n_svSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< List >::type bases(basesSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type n_sv(n_svSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(predict_ancestry_cpp(gmatrix, bases, n_sv, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// truncated_svd_cpp
+List truncated_svd_cpp(SEXP gmatrix, IntegerVector k, IntegerVector oversampling, IntegerVector power_iterations, IntegerVector threads);
+RcppExport SEXP _SVDFunctions_truncated_svd_cpp(SEXP gmatrixSEXP, SEXP kSEXP, SEXP oversamplingSEXP, SEXP power_iterationsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type k(kSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type oversampling(oversamplingSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type power_iterations(power_iterationsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(truncated_svd_cpp(gmatrix, k, oversampling, power_iterations, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// truncated_svd_file_cpp
+List truncated_svd_file_cpp(CharacterVector prefix, CharacterVector format, IntegerVector k, IntegerVector oversampling, IntegerVector power_iterations, IntegerVector threads);
+RcppExport SEXP _SVDFunctions_truncated_svd_file_cpp(SEXP prefixSEXP, SEXP formatSEXP, SEXP kSEXP, SEXP oversamplingSEXP, SEXP power_iterationsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type prefix(prefixSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type format(formatSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type k(kSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type oversampling(oversamplingSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type power_iterations(power_iterationsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(truncated_svd_file_cpp(prefix, format, k, oversampling, power_iterations, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// replace_missing_cpp
+SEXP replace_missing_cpp(SEXP gmatrix, IntegerVector threads);
+RcppExport SEXP _SVDFunctions_replace_missing_cpp(SEXP gmatrixSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type gmatrix(gmatrixSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(replace_missing_cpp(gmatrix, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// parse_binary
+List parse_binary(const CharacterVector& binary_prefix, const LogicalVector& ret_gmatrix, const LogicalVector& ret_counts);
+RcppExport SEXP _SVDFunctions_parse_binary(SEXP binary_prefixSEXP, SEXP ret_gmatrixSEXP, SEXP ret_countsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type binary_prefix(binary_prefixSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type ret_gmatrix(ret_gmatrixSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type ret_counts(ret_countsSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_binary(binary_prefix, ret_gmatrix, ret_counts));
     return rcpp_result_gen;
 END_RCPP
 }
 // parse_vcf
-List parse_vcf(const CharacterVector& filename, const CharacterVector& samples, const CharacterVector& bad_positions, const CharacterVector& allowed_variants, const IntegerVector& DP, const IntegerVector& GQ, const CharacterVector& regions, const LogicalVector& ret_gmatrix, const CharacterVector& binary_prefix);
-RcppExport SEXP _SVDFunctions_parse_vcf(SEXP filenameSEXP, SEXP samplesSEXP, SEXP bad_positionsSEXP, SEXP allowed_variantsSEXP, SEXP DPSEXP, SEXP GQSEXP, SEXP regionsSEXP, SEXP ret_gmatrixSEXP, SEXP binary_prefixSEXP) {
+List parse_vcf(const CharacterVector& filename, const CharacterVector& samples, const CharacterVector& bad_positions, const CharacterVector& allowed_variants, const IntegerVector& DP, const IntegerVector& GQ, const CharacterVector& regions, const LogicalVector& ret_gmatrix, const LogicalVector& sparse, const CharacterVector& binary_prefix, const LogicalVector& ret_counts, const IntegerVector& threads);
+RcppExport SEXP _SVDFunctions_parse_vcf(SEXP filenameSEXP, SEXP samplesSEXP, SEXP bad_positionsSEXP, SEXP allowed_variantsSEXP, SEXP DPSEXP, SEXP GQSEXP, SEXP regionsSEXP, SEXP ret_gmatrixSEXP, SEXP sparseSEXP, SEXP binary_prefixSEXP, SEXP ret_countsSEXP, SEXP threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -39,15 +148,87 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const IntegerVector& >::type GQ(GQSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type regions(regionsSEXP);
     Rcpp::traits::input_parameter< const LogicalVector& >::type ret_gmatrix(ret_gmatrixSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type sparse(sparseSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type binary_prefix(binary_prefixSEXP);
-    rcpp_result_gen = Rcpp::wrap(parse_vcf(filename, samples, bad_positions, allowed_variants, DP, GQ, regions, ret_gmatrix, binary_prefix));
+    Rcpp::traits::input_parameter< const LogicalVector& >::type ret_counts(ret_countsSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_vcf(filename, samples, bad_positions, allowed_variants, DP, GQ, regions, ret_gmatrix, sparse, binary_prefix, ret_counts, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// open_vcf_stream
+List open_vcf_stream(const CharacterVector& filename, const CharacterVector& samples, const CharacterVector& bad_positions, const CharacterVector& allowed_variants, const IntegerVector& DP, const IntegerVector& GQ);
+RcppExport SEXP _SVDFunctions_open_vcf_stream(SEXP filenameSEXP, SEXP samplesSEXP, SEXP bad_positionsSEXP, SEXP allowed_variantsSEXP, SEXP DPSEXP, SEXP GQSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type samples(samplesSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type bad_positions(bad_positionsSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type allowed_variants(allowed_variantsSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type DP(DPSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type GQ(GQSEXP);
+    rcpp_result_gen = Rcpp::wrap(open_vcf_stream(filename, samples, bad_positions, allowed_variants, DP, GQ));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_vcf_chunk
+List read_vcf_chunk(SEXP stream, const IntegerVector& size);
+RcppExport SEXP _SVDFunctions_read_vcf_chunk(SEXP streamSEXP, SEXP sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type stream(streamSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type size(sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_vcf_chunk(stream, size));
+    return rcpp_result_gen;
+END_RCPP
+}
+// parse_plink
+List parse_plink(const CharacterVector& bfile, const CharacterVector& samples, const CharacterVector& bad_positions, const CharacterVector& allowed_variants, const LogicalVector& ret_gmatrix, const CharacterVector& binary_prefix, const LogicalVector& ret_counts);
+RcppExport SEXP _SVDFunctions_parse_plink(SEXP bfileSEXP, SEXP samplesSEXP, SEXP bad_positionsSEXP, SEXP allowed_variantsSEXP, SEXP ret_gmatrixSEXP, SEXP binary_prefixSEXP, SEXP ret_countsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type bfile(bfileSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type samples(samplesSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type bad_positions(bad_positionsSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type allowed_variants(allowed_variantsSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type ret_gmatrix(ret_gmatrixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type binary_prefix(binary_prefixSEXP);
+    Rcpp::traits::input_parameter< const LogicalVector& >::type ret_counts(ret_countsSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_plink(bfile, samples, bad_positions, allowed_variants, ret_gmatrix, binary_prefix, ret_counts));
+    return rcpp_result_gen;
+END_RCPP
+}
+// harmonize_plink
+List harmonize_plink(const CharacterVector& bfile, const CharacterVector& positions, const CharacterVector& refs, const CharacterVector& alts);
+RcppExport SEXP _SVDFunctions_harmonize_plink(SEXP bfileSEXP, SEXP positionsSEXP, SEXP refsSEXP, SEXP altsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type bfile(bfileSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type positions(positionsSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type refs(refsSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type alts(altsSEXP);
+    rcpp_result_gen = Rcpp::wrap(harmonize_plink(bfile, positions, refs, alts));
     return rcpp_result_gen;
 END_RCPP
 }
-
 static const R_CallMethodDef CallEntries[] = {
-    {"_SVDFunctions_select_controls_cpp", (DL_FUNC) &_SVDFunctions_select_controls_cpp, 10},
-    {"_SVDFunctions_parse_vcf", (DL_FUNC) &_SVDFunctions_parse_vcf, 9},
+    {"_SVDFunctions_select_controls_cpp", (DL_FUNC) &_SVDFunctions_select_controls_cpp, 12},
+    {"_SVDFunctions_select_controls_batch_cpp", (DL_FUNC) &_SVDFunctions_select_controls_batch_cpp, 13},
+    {"_SVDFunctions_residual_norms_cpp", (DL_FUNC) &_SVDFunctions_residual_norms_cpp, 4},
+    {"_SVDFunctions_predict_ancestry_cpp", (DL_FUNC) &_SVDFunctions_predict_ancestry_cpp, 4},
+    {"_SVDFunctions_truncated_svd_cpp", (DL_FUNC) &_SVDFunctions_truncated_svd_cpp, 5},
+    {"_SVDFunctions_truncated_svd_file_cpp", (DL_FUNC) &_SVDFunctions_truncated_svd_file_cpp, 6},
+    {"_SVDFunctions_replace_missing_cpp", (DL_FUNC) &_SVDFunctions_replace_missing_cpp, 2},
+    {"_SVDFunctions_parse_binary", (DL_FUNC) &_SVDFunctions_parse_binary, 3},
+    {"_SVDFunctions_parse_vcf", (DL_FUNC) &_SVDFunctions_parse_vcf, 12},
+    {"_SVDFunctions_open_vcf_stream", (DL_FUNC) &_SVDFunctions_open_vcf_stream, 6},
+    {"_SVDFunctions_read_vcf_chunk", (DL_FUNC) &_SVDFunctions_read_vcf_chunk, 2},
+    {"_SVDFunctions_parse_plink", (DL_FUNC) &_SVDFunctions_parse_plink, 7},
+    {"_SVDFunctions_harmonize_plink", (DL_FUNC) &_SVDFunctions_harmonize_plink, 4},
     {NULL, NULL, 0}
 };
 
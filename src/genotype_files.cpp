@@ -0,0 +1,142 @@
+#include "genotype_files.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+    using vcf::ParserException;
+
+    const unsigned char BED_MAGIC[] = {0x6c, 0x1b, 0x01};
+    const unsigned long BED_HEADER = 3;
+
+    // 2-bit .bed codes: 00 - homozygous first allele, 01 - missing,
+    // 10 - heterozygous, 11 - homozygous second allele.
+    const unsigned char BED_GENOTYPES[] = {0, variant_block::MISSING, 1, 2};
+
+    bool blank(const std::string& line) {
+        return std::all_of(line.begin(), line.end(), isspace);
+    }
+
+    unsigned long file_size(std::ifstream& in) {
+        in.seekg(0, std::ios::end);
+        unsigned long size = (unsigned long)in.tellg();
+        in.seekg(0, std::ios::beg);
+        return size;
+    }
+}
+
+binary_source::binary_source(const std::string& prefix)
+        :binary(prefix + "_bin", std::ios::binary), n_samples(0), n_variants(0), position(0) {
+    std::ifstream meta(prefix + "_meta");
+    if (!meta || !binary) {
+        throw ParserException("Can't open binary files with prefix " + prefix);
+    }
+    std::string line;
+    getline(meta, line);
+    std::istringstream iss(line);
+    std::string sample;
+    while (iss >> sample) {
+        ++n_samples;
+    }
+    while (getline(meta, line)) {
+        if (!blank(line)) {
+            ++n_variants;
+        }
+    }
+    if (file_size(binary) != n_variants * n_samples * sizeof(vcf::AlleleBinary)) {
+        throw ParserException("Binary file doesn't match its metadata");
+    }
+    record.resize(n_samples);
+}
+
+unsigned long binary_source::samples() const {
+    return n_samples;
+}
+
+unsigned long binary_source::variants() const {
+    return n_variants;
+}
+
+void binary_source::rewind() {
+    binary.clear();
+    binary.seekg(0, std::ios::beg);
+    position = 0;
+}
+
+unsigned long binary_source::read(variant_block& block) {
+    unsigned long count = std::min(block.capacity(), n_variants - position);
+    for (unsigned long r = 0; r < count; r++) {
+        binary.read(reinterpret_cast<char*>(record.data()), sizeof(vcf::AlleleBinary) * n_samples);
+        if (!binary) {
+            throw ParserException("Can't read binary file");
+        }
+        unsigned char* row = block.row(r);
+        for (unsigned long i = 0; i < n_samples; i++) {
+            row[i] = std::min(record[i].allele, (uint8_t)variant_block::MISSING);
+        }
+    }
+    position += count;
+    return count;
+}
+
+bed_source::bed_source(const std::string& bfile)
+        :bed(bfile + ".bed", std::ios::binary), n_samples(0), n_variants(0), position(0) {
+    std::ifstream bim(bfile + ".bim");
+    std::ifstream fam(bfile + ".fam");
+    if (!bed || !bim || !fam) {
+        throw ParserException("Can't open PLINK files with prefix " + bfile);
+    }
+    std::string line;
+    while (getline(fam, line)) {
+        std::istringstream iss(line);
+        std::string family, sample;
+        if (iss >> family >> sample) {
+            ++n_samples;
+        }
+    }
+    while (getline(bim, line)) {
+        if (!blank(line)) {
+            ++n_variants;
+        }
+    }
+    record.resize((n_samples + 3) / 4);
+    unsigned long size = file_size(bed);
+    unsigned char magic[BED_HEADER];
+    bed.read(reinterpret_cast<char*>(magic), BED_HEADER);
+    if (!bed || !std::equal(magic, magic + BED_HEADER, BED_MAGIC)) {
+        throw ParserException("Wrong .bed file: only SNP-major .bed files are supported");
+    }
+    if (size != BED_HEADER + n_variants * record.size()) {
+        throw ParserException(".bed file doesn't match .bim and .fam files");
+    }
+}
+
+unsigned long bed_source::samples() const {
+    return n_samples;
+}
+
+unsigned long bed_source::variants() const {
+    return n_variants;
+}
+
+void bed_source::rewind() {
+    bed.clear();
+    bed.seekg(BED_HEADER, std::ios::beg);
+    position = 0;
+}
+
+unsigned long bed_source::read(variant_block& block) {
+    unsigned long count = std::min(block.capacity(), n_variants - position);
+    for (unsigned long r = 0; r < count; r++) {
+        bed.read(reinterpret_cast<char*>(record.data()), record.size());
+        if (!bed) {
+            throw ParserException("Can't read .bed file");
+        }
+        unsigned char* row = block.row(r);
+        for (unsigned long i = 0; i < n_samples; i++) {
+            row[i] = BED_GENOTYPES[(record[i >> 2] >> ((i & 3) << 1)) & 3];
+        }
+    }
+    position += count;
+    return count;
+}
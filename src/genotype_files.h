@@ -0,0 +1,45 @@
+#ifndef SRC_GENOTYPE_FILES_H
+#define SRC_GENOTYPE_FILES_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "genotype_source.h"
+#include "vcf_primitives.h"
+
+// Genotypes stored by BinaryFileHandler in <prefix>_bin with metadata in
+// <prefix>_meta.
+class binary_source : public genotype_source {
+    std::ifstream binary;
+    std::vector<vcf::AlleleBinary> record;
+    unsigned long n_samples;
+    unsigned long n_variants;
+    unsigned long position;
+public:
+    explicit binary_source(const std::string& prefix);
+
+    unsigned long samples() const override;
+    unsigned long variants() const override;
+    void rewind() override;
+    unsigned long read(variant_block& block) override;
+};
+
+// Genotypes of a SNP-major PLINK .bed file as the number of copies of the
+// second .bim allele, without any harmonization of alleles.
+class bed_source : public genotype_source {
+    std::ifstream bed;
+    std::vector<unsigned char> record;
+    unsigned long n_samples;
+    unsigned long n_variants;
+    unsigned long position;
+public:
+    explicit bed_source(const std::string& bfile);
+
+    unsigned long samples() const override;
+    unsigned long variants() const override;
+    void rewind() override;
+    unsigned long read(variant_block& block) override;
+};
+
+#endif //SRC_GENOTYPE_FILES_H
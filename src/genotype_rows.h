@@ -0,0 +1,32 @@
+#ifndef SRC_GENOTYPE_ROWS_H
+#define SRC_GENOTYPE_ROWS_H
+
+#include <vector>
+
+// Genotypes of controls in one contiguous buffer, a row of one byte per SNP
+// for every control.
+class genotype_rows {
+    std::vector<unsigned char> data;
+    unsigned long n_controls;
+    unsigned long n_snps;
+public:
+    // Same code as variant_block::MISSING.
+    static const unsigned char MISSING = 3;
+
+    genotype_rows(unsigned long n_controls, unsigned long n_snps)
+            :data(n_controls * n_snps), n_controls(n_controls), n_snps(n_snps) {}
+
+    unsigned char* row(unsigned long i) {
+        return data.data() + i * n_snps;
+    }
+
+    const unsigned char* row(unsigned long i) const {
+        return data.data() + i * n_snps;
+    }
+
+    unsigned long controls() const {
+        return n_controls;
+    }
+};
+
+#endif //SRC_GENOTYPE_ROWS_H
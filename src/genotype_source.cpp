@@ -0,0 +1,57 @@
+#include "genotype_source.h"
+#include "impute.h"
+
+unsigned long genotype_source::next(variant_block& block) {
+    unsigned long count = read(block);
+    auto missing = [](unsigned char value) {
+        return value == variant_block::MISSING;
+    };
+    impute_variant_major(block.row(0), count, samples(), missing);
+    return count;
+}
+
+prefetching_source::prefetching_source(genotype_source& source)
+        :source(source), spare(0, 0) {}
+
+prefetching_source::~prefetching_source() {
+    if (pending.valid()) {
+        pending.wait();
+    }
+}
+
+unsigned long prefetching_source::samples() const {
+    return source.samples();
+}
+
+unsigned long prefetching_source::variants() const {
+    return source.variants();
+}
+
+void prefetching_source::prefetch() {
+    pending = std::async(std::launch::async, [this]() {
+        return source.read(spare);
+    });
+}
+
+void prefetching_source::rewind() {
+    if (pending.valid()) {
+        pending.wait();
+        pending = std::future<unsigned long>();
+    }
+    source.rewind();
+}
+
+unsigned long prefetching_source::read(variant_block& block) {
+    if (!pending.valid()) {
+        if (spare.capacity() != block.capacity()) {
+            spare = variant_block(block.capacity(), samples());
+        }
+        prefetch();
+    }
+    unsigned long count = pending.get();
+    block.swap(spare);
+    if (count > 0) {
+        prefetch();
+    }
+    return count;
+}
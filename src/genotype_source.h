@@ -0,0 +1,76 @@
+#ifndef SRC_GENOTYPE_SOURCE_H
+#define SRC_GENOTYPE_SOURCE_H
+
+#include <vector>
+#include <future>
+
+// Genotypes of consecutive variants, a row of one byte per sample.
+class variant_block {
+    std::vector<unsigned char> data;
+    unsigned long n_variants;
+    unsigned long n_samples;
+public:
+    static const unsigned char MISSING = 3;
+
+    variant_block(unsigned long n_variants, unsigned long n_samples)
+            :data(n_variants * n_samples), n_variants(n_variants), n_samples(n_samples) {}
+
+    unsigned char* row(unsigned long i) {
+        return data.data() + i * n_samples;
+    }
+
+    const unsigned char* row(unsigned long i) const {
+        return data.data() + i * n_samples;
+    }
+
+    unsigned long capacity() const {
+        return n_variants;
+    }
+
+    void swap(variant_block& other) {
+        data.swap(other.data);
+        std::swap(n_variants, other.n_variants);
+        std::swap(n_samples, other.n_samples);
+    }
+};
+
+// Genotypes read block by block of variants, in as many passes as needed,
+// so that the whole matrix doesn't have to be kept in memory.
+class genotype_source {
+public:
+    virtual ~genotype_source() {}
+
+    virtual unsigned long samples() const = 0;
+    virtual unsigned long variants() const = 0;
+
+    // Starts a new pass from the first variant.
+    virtual void rewind() = 0;
+    // Fills rows of the block with the next variants and returns their
+    // number, 0 once the pass is over. Missing genotypes are MISSING.
+    virtual unsigned long read(variant_block& block) = 0;
+
+    // Same as read() with missing genotypes replaced by the mean genotype
+    // of the variant rounded to an integer like round() in R, 0 if all of
+    // them are missing.
+    unsigned long next(variant_block& block);
+};
+
+// Reads the next block of another source in a background thread while the
+// current one is processed. The wrapped source must not call into R.
+class prefetching_source : public genotype_source {
+    genotype_source& source;
+    variant_block spare;
+    std::future<unsigned long> pending;
+
+    void prefetch();
+public:
+    explicit prefetching_source(genotype_source& source);
+    ~prefetching_source() override;
+
+    unsigned long samples() const override;
+    unsigned long variants() const override;
+    void rewind() override;
+    unsigned long read(variant_block& block) override;
+};
+
+#endif //SRC_GENOTYPE_SOURCE_H
@@ -0,0 +1,87 @@
+#ifndef SRC_IMPUTE_H
+#define SRC_IMPUTE_H
+
+#include <vector>
+#include <cmath>
+
+#include "thread_pool.h"
+
+// Missing values of every variant are replaced by the mean of the present
+// values of the variant rounded to an integer, half to even like round() in
+// R, or by 0 if all of them are missing. Variants are split between
+// threads.
+
+// Values of a variant are contiguous (row-major variants x samples).
+template<typename T, typename Missing>
+void impute_variant_major(T* values, unsigned long n_variants, unsigned long n_samples, Missing missing,
+                          int threads = 1) {
+    thread_pool pool(threads);
+    int n_tasks = pool.size();
+    pool.run(n_tasks, [&](int task) {
+        unsigned long from = n_variants * task / n_tasks;
+        unsigned long to = n_variants * (task + 1) / n_tasks;
+        for (unsigned long j = from; j < to; j++) {
+            T* row = values + j * n_samples;
+            double sum = 0;
+            unsigned long called = 0;
+            for (unsigned long i = 0; i < n_samples; i++) {
+                if (!missing(row[i])) {
+                    sum += row[i];
+                    ++called;
+                }
+            }
+            if (called == n_samples) {
+                continue;
+            }
+            T mean = called == 0 ? (T)0 : (T)std::nearbyint(sum / called);
+            for (unsigned long i = 0; i < n_samples; i++) {
+                if (missing(row[i])) {
+                    row[i] = mean;
+                }
+            }
+        }
+    });
+}
+
+// Values of a sample are contiguous (column-major variants x samples, the
+// layout of R matrices).
+template<typename T, typename Missing>
+void impute_sample_major(T* values, unsigned long n_variants, unsigned long n_samples, Missing missing,
+                         int threads = 1) {
+    thread_pool pool(threads);
+    int n_tasks = pool.size();
+    pool.run(n_tasks, [&](int task) {
+        unsigned long from = n_variants * task / n_tasks;
+        unsigned long to = n_variants * (task + 1) / n_tasks;
+        std::vector<double> sum(to - from);
+        std::vector<unsigned long> called(to - from);
+        for (unsigned long i = 0; i < n_samples; i++) {
+            const T* column = values + i * n_variants;
+            for (unsigned long j = from; j < to; j++) {
+                if (!missing(column[j])) {
+                    sum[j - from] += column[j];
+                    ++called[j - from];
+                }
+            }
+        }
+        std::vector<T> mean(to - from);
+        bool complete = true;
+        for (unsigned long j = from; j < to; j++) {
+            complete = complete && called[j - from] == n_samples;
+            mean[j - from] = called[j - from] == 0 ? (T)0 : (T)std::nearbyint(sum[j - from] / called[j - from]);
+        }
+        if (complete) {
+            return;
+        }
+        for (unsigned long i = 0; i < n_samples; i++) {
+            T* column = values + i * n_variants;
+            for (unsigned long j = from; j < to; j++) {
+                if (missing(column[j])) {
+                    column[j] = mean[j - from];
+                }
+            }
+        }
+    });
+}
+
+#endif //SRC_IMPUTE_H
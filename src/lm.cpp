@@ -1,9 +1,11 @@
 // [[Rcpp::depends(BH)]]
 
 #include <cmath>
+#include <algorithm>
 #include <boost/math/special_functions/beta.hpp>
 
 #include "lm.h"
+#include "qchisq.h"
 
 double pval_t(double t, double df) {
     if (df > 50) {
@@ -13,6 +15,20 @@ double pval_t(double t, double df) {
     return boost::math::ibeta(df / 2, 0.5, x);
 }
 
+void chi2_t(double* t, unsigned long n, double df) {
+    if (df > 50) {
+        // Normal approximation, qnorm(pnorm(-|t|))^2 is t^2 itself.
+        for (unsigned long i = 0; i < n; i++) {
+            t[i] *= t[i];
+        }
+        return;
+    }
+    for (unsigned long i = 0; i < n; i++) {
+        t[i] = pval_t(t[i], df);
+    }
+    qchisq_upper(t, n, t);
+}
+
 lm::lm(unsigned _n) :lt(_n * 2), n(_n), b(_n), R(4), v(_n), vM(_n), Q(_n * 2) {}
 
 double lm::norm(const std::vector<double>& v) {
@@ -135,3 +151,43 @@ double lm::get_bias() {
     return bias;
 }
 
+
+snp_regression::snp_regression() :w(0), x(0), xx(0), y(0), xy(0), yy(0), k(0), rss(0), cross(0) {}
+
+void snp_regression::set_cases(int hom_ref, int het, int hom) {
+    double cases = hom_ref + het + hom;
+    w += cases;
+    x += het + 2.0 * hom;
+    xx += het + 4.0 * hom;
+    y += cases;
+    xy += het + 2.0 * hom;
+    yy += cases;
+}
+
+void snp_regression::add_control(int genotype) {
+    w += 1;
+    x += genotype;
+    xx += genotype * genotype;
+}
+
+void snp_regression::add_controls(int hom_ref, int het, int hom) {
+    w += hom_ref + het + hom;
+    x += het + 2.0 * hom;
+    xx += het + 4.0 * hom;
+}
+
+void snp_regression::solve() {
+    cross = w * xx - x * x;
+    double nxy = w * xy - x * y;
+    double nyy = w * yy - y * y;
+    k = nxy / cross;
+    rss = std::max(0.0, (nyy - k * nxy) / w);
+}
+
+double snp_regression::get_lambda() {
+    return k;
+}
+
+double snp_regression::compute_t(double df) {
+    return k / std::sqrt((rss / df) * (w / cross));
+}
@@ -5,6 +5,10 @@
 
 double pval_t(double t, double df);
 
+// Replaces t statistics with chi-square statistics with one degree of freedom
+// that have the same two-sided p-values.
+void chi2_t(double* t, unsigned long n, double df);
+
 class lm {
     std::vector<double> lt;
     std::vector<double> b;
@@ -33,5 +37,29 @@ public:
     double compute_t(double df);
 };
 
+// Weighted regression of case/control status on genotype for a single SNP.
+// Cases are fixed, controls are added one at a time, so only the weighted
+// sums of the design are kept and each update is O(1).
+class snp_regression {
+    double w;
+    double x;
+    double xx;
+    double y;
+    double xy;
+    double yy;
+    double k;
+    double rss;
+    double cross;
+public:
+    snp_regression();
+    void set_cases(int hom_ref, int het, int hom);
+    void add_control(int genotype);
+    void add_controls(int hom_ref, int het, int hom);
+    void solve();
+    double get_lambda();
+
+    double compute_t(double df);
+};
+
 
 #endif //SRC_LM_H
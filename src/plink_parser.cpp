@@ -0,0 +1,231 @@
+#include "plink_parser.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+    using namespace vcf;
+
+    using std::string;
+    using std::vector;
+
+    const unsigned char MAGIC_1 = 0x6c;
+    const unsigned char MAGIC_2 = 0x1b;
+    const unsigned long HEADER = 3;
+
+    // 2-bit codes: 00 - homozygous first allele, 01 - missing,
+    // 10 - heterozygous, 11 - homozygous second allele.
+    const AlleleType CODES[] = {HOMREF, MISSING, HET, HOM};
+
+    // Genotype g becomes 2 - g: codes with equal bits (00 and 11) are
+    // inverted, missing and heterozygous codes stay as they are.
+    void flip(vector<unsigned char>& block) {
+        for (unsigned char& byte: block) {
+            unsigned char equal = (unsigned char)(~(byte ^ (byte >> 1)) & 0x55);
+            byte ^= equal | (equal << 1);
+        }
+    }
+
+    bool blank(const string& line) {
+        return std::all_of(line.begin(), line.end(), isspace);
+    }
+
+    unsigned long file_size(std::ifstream& in) {
+        in.seekg(0, std::ios::end);
+        unsigned long size = (unsigned long)in.tellg();
+        in.seekg(0, std::ios::beg);
+        return size;
+    }
+
+    string chromosome_name(const string& code) {
+        if (code == "23") {
+            return "X";
+        }
+        if (code == "24") {
+            return "Y";
+        }
+        return code;
+    }
+}
+
+namespace vcf {
+
+    AlleleHarmonizer::AlleleHarmonizer() :summary() {}
+
+    void AlleleHarmonizer::add(const Variant& variant) {
+        reference[variant.position()].emplace_back(variant.reference(), variant.alternative());
+    }
+
+    Harmonization AlleleHarmonizer::classify(const Variant& variant) {
+        Harmonization result = ABSENT;
+        auto alleles = reference.find(variant.position());
+        if (alleles != reference.end()) {
+            result = MISMATCH;
+            for (const auto& pair: alleles->second) {
+                if (pair.first == variant.reference() && pair.second == variant.alternative()) {
+                    result = MATCH;
+                    break;
+                }
+                if (pair.first == variant.alternative() && pair.second == variant.reference()) {
+                    result = SWAP;
+                }
+            }
+        }
+        if (result == MATCH || result == SWAP) {
+            Variant oriented = result == MATCH ? variant
+                    : Variant(variant.position(), variant.alternative(), variant.reference());
+            if (!accepted.insert(oriented).second) {
+                result = DUPLICATE;
+            }
+        }
+        if (result == MISMATCH) {
+            mismatches.push_back(variant);
+        }
+        ++summary[result];
+        return result;
+    }
+
+    const std::array<int, 5>& AlleleHarmonizer::counts() const {
+        return summary;
+    }
+
+    const std::vector<Variant>& AlleleHarmonizer::mismatched() const {
+        return mismatches;
+    }
+
+    PlinkParser::PlinkParser(const std::string& bfile, const VCFFilter& filter)
+            :filter(filter), bed(bfile + ".bed", std::ios::binary), bim(bfile + ".bim"), fam(bfile + ".fam"),
+             n_samples(0), line_num(0) {
+        if (!bed || !bim || !fam) {
+            throw ParserException("Can't open PLINK files with prefix " + bfile);
+        }
+    }
+
+    void PlinkParser::register_handler(std::shared_ptr<VariantsHandler> handler) {
+        handlers.push_back(handler);
+    }
+
+    void PlinkParser::set_reference(std::shared_ptr<AlleleHarmonizer> reference) {
+        harmonizer = reference;
+    }
+
+    std::vector<std::string> PlinkParser::sample_names() {
+        return samples;
+    }
+
+    ParserDiagnostics& PlinkParser::diagnostics() {
+        return errors;
+    }
+
+    void PlinkParser::parse_header() {
+        string line;
+        while (getline(fam, line)) {
+            std::istringstream iss(line);
+            string family, sample;
+            if (!(iss >> family >> sample)) {
+                continue;
+            }
+            if (filter.apply(sample)) {
+                samples.push_back(sample);
+                filtered_samples.push_back((int)n_samples);
+            }
+            ++n_samples;
+        }
+
+        unsigned long n_variants = 0;
+        while (getline(bim, line)) {
+            if (!blank(line)) {
+                ++n_variants;
+            }
+        }
+        bim.clear();
+        bim.seekg(0, std::ios::beg);
+
+        unsigned long size = file_size(bed);
+        char magic[HEADER];
+        bed.read(magic, HEADER);
+        if (!bed || (unsigned char)magic[0] != MAGIC_1 || (unsigned char)magic[1] != MAGIC_2) {
+            throw ParserException("Wrong .bed file: magic number mismatch");
+        }
+        if (magic[2] != SNP_MAJOR) {
+            throw ParserException("Only SNP-major .bed files are supported");
+        }
+        if (size != HEADER + n_variants * ((n_samples + 3) / 4)) {
+            throw ParserException(".bed file doesn't match .bim and .fam files");
+        }
+    }
+
+    bool PlinkParser::parse_variant(const std::string& line, Variant& variant) {
+        std::istringstream iss(line);
+        string chr, id, morgans, pos, first, second;
+        iss >> chr >> id >> morgans >> pos >> first >> second;
+        if (iss.fail()) {
+            errors.add(WRONG_LINE_FORMAT, line_num);
+            return false;
+        }
+        Chromosome chromosome("1");
+        if (!Chromosome::try_parse(chromosome_name(chr), chromosome)) {
+            errors.add(UNKNOWN_CHROMOSOME, line_num, chr);
+            return false;
+        }
+        int position;
+        try {
+            position = std::stoi(pos);
+        } catch (...) {
+            errors.add(WRONG_POSITION, line_num);
+            return false;
+        }
+        variant = Variant(Position(chromosome, position), first, second);
+        return true;
+    }
+
+    void PlinkParser::parse_genotypes() {
+        unsigned long block_size = (n_samples + 3) / 4;
+        vector<unsigned char> block(block_size);
+        vector<Allele> alleles;
+        Variant variant(Position(Chromosome("1"), 0), "", "");
+        string line;
+        while (getline(bim, line)) {
+            ++line_num;
+            if (blank(line)) {
+                continue;
+            }
+            bed.read(reinterpret_cast<char*>(block.data()), block_size);
+            if (!bed) {
+                throw ParserException(".bed file has fewer variants than .bim file", line_num);
+            }
+            if (!parse_variant(line, variant)) {
+                continue;
+            }
+            if (!filter.apply(variant.position())) {
+                continue;
+            }
+            Variant swapped(variant.position(), variant.alternative(), variant.reference());
+            bool swap = false;
+            if (harmonizer) {
+                Harmonization harmonization = harmonizer->classify(variant);
+                if (harmonization != MATCH && harmonization != SWAP) {
+                    continue;
+                }
+                swap = harmonization == SWAP;
+            } else if (!filter.apply(variant)) {
+                if (!filter.apply(swapped)) {
+                    continue;
+                }
+                swap = true;
+            }
+            if (swap) {
+                variant = swapped;
+                flip(block);
+            }
+            alleles.clear();
+            for (int sample: filtered_samples) {
+                int code = (block[sample >> 2] >> ((sample & 3) << 1)) & 3;
+                alleles.emplace_back(CODES[code], 0, 0);
+            }
+            for (auto& handler: handlers) {
+                handler->processVariant(variant, alleles);
+            }
+        }
+    }
+}
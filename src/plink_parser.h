@@ -0,0 +1,67 @@
+#ifndef SRC_PLINK_PARSER_H
+#define SRC_PLINK_PARSER_H
+
+#include <fstream>
+#include <array>
+
+#include "vcf_primitives.h"
+#include "vcf_filter.h"
+#include "vcf_handlers.h"
+
+namespace vcf {
+    enum Harmonization {MATCH, SWAP, MISMATCH, DUPLICATE, ABSENT};
+
+    // Reference alleles hashed by position. Classifies variants of a
+    // genotype file against them and remembers what was already accepted.
+    class AlleleHarmonizer {
+        std::unordered_map<Position, std::vector<std::pair<std::string, std::string>>> reference;
+        std::unordered_set<Variant> accepted;
+        std::array<int, 5> summary;
+        std::vector<Variant> mismatches;
+    public:
+        AlleleHarmonizer();
+        void add(const Variant& variant);
+        Harmonization classify(const Variant& variant);
+
+        const std::array<int, 5>& counts() const;
+        const std::vector<Variant>& mismatched() const;
+    };
+
+    // Reads PLINK .bed/.bim/.fam triples. Genotypes are the number of copies
+    // of the second .bim allele, so REF is the first one unless the allowed
+    // variants list (or the reference alleles, if given) has the swapped
+    // pair, in which case genotypes are flipped.
+    class PlinkParser {
+        static const int SNP_MAJOR = 1;
+
+        VCFFilter filter;
+
+        std::vector<std::shared_ptr<VariantsHandler>> handlers;
+        std::shared_ptr<AlleleHarmonizer> harmonizer;
+        std::ifstream bed;
+        std::ifstream bim;
+        std::ifstream fam;
+        std::vector<std::string> samples;
+        std::vector<int> filtered_samples;
+        unsigned long n_samples;
+
+        int line_num;
+        ParserDiagnostics errors;
+
+        // Lines of .bim file that can't be read are counted and skipped.
+        bool parse_variant(const std::string& line, Variant& variant);
+
+    public:
+        PlinkParser(const std::string& bfile, const VCFFilter& filter);
+        void parse_header();
+        void parse_genotypes();
+        void register_handler(std::shared_ptr<VariantsHandler> handler);
+        void set_reference(std::shared_ptr<AlleleHarmonizer> reference);
+
+        std::vector<std::string> sample_names();
+        // Lines skipped because of errors, counted by error.
+        ParserDiagnostics& diagnostics();
+    };
+}
+
+#endif //SRC_PLINK_PARSER_H
@@ -1,20 +1,80 @@
 #include "qchisq.h"
-#include <fstream>
 #include <cmath>
+#include <limits>
+#include <algorithm>
 
-qchi2::qchi2(const std::vector<double>& precomputed_values) {
-    precomputed = precomputed_values;
-    a = precomputed.size() > 10 ? 0.5 : 3.0 / 8;
+namespace {
+    // Wichura, M. J. (1988) Algorithm AS 241: The percentage points of the
+    // normal distribution. Applied Statistics, 37, 477-484.
+    const double A[] = {3.3871328727963666080e0, 1.3314166789178437745e+2, 1.9715909503065514427e+3,
+                        1.3731693765509461125e+4, 4.5921953931549871457e+4, 6.7265770927008700853e+4,
+                        3.3430575583588128105e+4, 2.5090809287301226727e+3};
+    const double B[] = {1.0, 4.2313330701600911252e+1, 6.8718700749205790830e+2, 5.3941960214247511077e+3,
+                        2.1213794301586595867e+4, 3.9307895800092710610e+4, 2.8729085735721942674e+4,
+                        5.2264952788528545610e+3};
+    const double C[] = {1.42343711074968357734e0, 4.63033784615654529590e0, 5.76949722146069140550e0,
+                        3.64784832476320460504e0, 1.27045825245236838258e0, 2.41780725177450611770e-1,
+                        2.27238449892691845833e-2, 7.74545014278341407640e-4};
+    const double D[] = {1.0, 2.05319162663775882187e0, 1.67638483018380384940e0, 6.89767334985100004550e-1,
+                        1.48103976427480074590e-1, 1.51986665636164571966e-2, 5.47593808499534494600e-4,
+                        1.05075007164441684324e-9};
+    const double E[] = {6.65790464350110377720e0, 5.46378491116411436990e0, 1.78482653991729133580e0,
+                        2.96560571828504891230e-1, 2.65321895265761230930e-2, 1.24266094738807843860e-3,
+                        2.71155556874348757815e-5, 2.01033439929228813265e-7};
+    const double F[] = {1.0, 5.99832206555887937690e-1, 1.36929880922735805310e-1, 1.48753612908506148525e-2,
+                        7.86869131145613259100e-4, 1.84631831751005468180e-5, 1.42151175831644588870e-7,
+                        2.04426310338993978564e-15};
+
+    const double SPLIT_CENTRAL = 0.425;
+    const double SPLIT_TAIL = 5.0;
+
+    inline double rational(const double* num, const double* den, double r) {
+        double a = ((((((num[7] * r + num[6]) * r + num[5]) * r + num[4]) * r + num[3]) * r + num[2]) * r + num[1])
+                   * r + num[0];
+        double b = ((((((den[7] * r + den[6]) * r + den[5]) * r + den[4]) * r + den[3]) * r + den[2]) * r + den[1])
+                   * r + den[0];
+        return a / b;
+    }
+
+    inline double central(double q) {
+        return q * rational(A, B, SPLIT_CENTRAL * SPLIT_CENTRAL - q * q);
+    }
+
+    inline double tail(double q, double p) {
+        double r = std::sqrt(-std::log(q < 0 ? p : 1 - p));
+        double value = r <= SPLIT_TAIL ? rational(C, D, r - 1.6) : rational(E, F, r - SPLIT_TAIL);
+        return q < 0 ? -value : value;
+    }
+}
+
+double qnorm(double p) {
+    double q = p - 0.5;
+    if (std::abs(q) <= SPLIT_CENTRAL) {
+        return central(q);
+    }
+    if (p <= 0) {
+        return -std::numeric_limits<double>::infinity();
+    }
+    if (p >= 1) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return tail(q, p);
 }
 
-double qchi2::call(double p) {
-    p = 1 - p;
-    int k = (int)std::lround(p * (precomputed.size() + 1 - 2 * a) + a) - 1;
-    k = std::max(k, 0);
-    k = std::min(k, (int)precomputed.size() - 1);
-    return precomputed[k];
+// qchisq(p, 1, lower.tail = FALSE) = qnorm(p / 2)^2. P-values below the
+// smallest normal double are treated as equal to it so that the quantiles
+// stay finite.
+void qchisq_upper(const double* p, unsigned long n, double* q) {
+    const double smallest = std::numeric_limits<double>::min();
+    for (unsigned long i = 0; i < n; i++) {
+        double half = std::max(p[i], smallest) / 2;
+        double x = half < 0.5 - SPLIT_CENTRAL ? tail(half - 0.5, half) : central(half - 0.5);
+        q[i] = x * x;
+    }
 }
 
-std::function<double(double)> qchi2::function() {
-    return [this](double p) {return call(p);};
+void pchisq_upper(const double* q, unsigned long n, double* p) {
+    for (unsigned long i = 0; i < n; i++) {
+        p[i] = std::erfc(std::sqrt(q[i] / 2));
+    }
 }
@@ -1,17 +1,12 @@
 #ifndef SRC_QCHISQ_H
 #define SRC_QCHISQ_H
 
-#include <vector>
-#include <functional>
-
-class qchi2 {
-    std::vector<double> precomputed;
-    double a;
-public:
-    qchi2(const std::vector<double>& precomputed_values);
-    double call(double p);
-    std::function<double(double)> function();
-};
+// Quantile function of the standard normal distribution, algorithm AS 241.
+double qnorm(double p);
 
+// Upper quantiles of the chi-square distribution with one degree of freedom
+// and their inverse, element-wise over arrays. Input and output may alias.
+void qchisq_upper(const double* p, unsigned long n, double* q);
+void pchisq_upper(const double* q, unsigned long n, double* p);
 
 #endif //SRC_QCHISQ_H
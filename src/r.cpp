@@ -1,59 +1,378 @@
 #include <Rcpp.h>
 #include <vector>
 
-#include "qchisq.h"
 #include "utils.h"
+#include "residuals.h"
+#include "svd.h"
+#include "genotype_files.h"
+#include "impute.h"
 
 using namespace Rcpp;
 using std::vector;
 
+namespace {
+    inline int genotype(double value) {
+        return ISNAN(value) ? -1 : (int)std::lround(value);
+    }
+
+    inline int genotype(int value) {
+        return value == NA_INTEGER ? -1 : value;
+    }
+
+    inline int genotype(Rbyte value) {
+        return value;
+    }
+
+    inline bool missing(double value) {
+        return ISNAN(value);
+    }
+
+    inline bool missing(int value) {
+        return value == NA_INTEGER;
+    }
+
+    inline bool missing(Rbyte) {
+        return false;
+    }
+
+    // Copies columns of an R genotype matrix to rows, NA genotypes become
+    // missing.
+    template<typename T>
+    void fill_rows(const T* values, unsigned long n_controls, unsigned long n_snps, genotype_rows& rows) {
+        for (unsigned long i = 0; i < n_controls; i++) {
+            const T* column = values + i * n_snps;
+            unsigned char* row = rows.row(i);
+            for (unsigned long j = 0; j < n_snps; j++) {
+                if (missing(column[j])) {
+                    row[j] = genotype_rows::MISSING;
+                    continue;
+                }
+                int value = genotype(column[j]);
+                if (value < 0 || value > 2) {
+                    stop("Genotype matrix can only contain 0, 1 and 2");
+                }
+                row[j] = (unsigned char)value;
+            }
+        }
+    }
+
+    genotype_rows read_genotypes(SEXP gmatrix) {
+        if (!Rf_isMatrix(gmatrix)) {
+            stop("Genotype matrix must be a matrix");
+        }
+        int n_c = Rf_ncols(gmatrix);
+        int n_snps = Rf_nrows(gmatrix);
+        genotype_rows rows(n_c, n_snps);
+        switch (TYPEOF(gmatrix)) {
+            case INTSXP:
+                fill_rows(INTEGER(gmatrix), n_c, n_snps, rows);
+                break;
+            case REALSXP:
+                fill_rows(REAL(gmatrix), n_c, n_snps, rows);
+                break;
+            case RAWSXP:
+                fill_rows(RAW(gmatrix), n_c, n_snps, rows);
+                break;
+            default:
+                stop("Genotype matrix must be integer, numeric or raw");
+        }
+        return rows;
+    }
+
+    // Missing genotypes are imputed like ReplaceMissing does.
+    void impute(genotype_rows& rows, unsigned long n_snps, int threads) {
+        auto is_missing = [](unsigned char value) {
+            return value == genotype_rows::MISSING;
+        };
+        impute_sample_major(rows.row(0), n_snps, rows.controls(), is_missing, threads);
+    }
+
+    genotype_rows read_imputed_genotypes(SEXP gmatrix, int threads) {
+        genotype_rows rows = read_genotypes(gmatrix);
+        impute(rows, Rf_nrows(gmatrix), threads);
+        return rows;
+    }
+
+    // Rows of a column-major R matrix, NA genotypes become missing.
+    template<typename T>
+    void fill_variants(const T* values, unsigned long n_snps, unsigned long first, unsigned long count,
+                       unsigned long n_samples, variant_block& block) {
+        for (unsigned long i = 0; i < n_samples; i++) {
+            const T* column = values + i * n_snps + first;
+            for (unsigned long r = 0; r < count; r++) {
+                if (missing(column[r])) {
+                    block.row(r)[i] = variant_block::MISSING;
+                    continue;
+                }
+                int value = genotype(column[r]);
+                if (value < 0 || value > 2) {
+                    stop("Genotype matrix can only contain 0, 1 and 2");
+                }
+                block.row(r)[i] = (unsigned char)value;
+            }
+        }
+    }
+
+    // Variants of an R genotype matrix converted block by block.
+    class matrix_source : public genotype_source {
+        SEXP gmatrix;
+        unsigned long n_samples;
+        unsigned long n_snps;
+        unsigned long position;
+    public:
+        explicit matrix_source(SEXP gmatrix)
+                :gmatrix(gmatrix), n_samples(Rf_ncols(gmatrix)), n_snps(Rf_nrows(gmatrix)), position(0) {}
+
+        unsigned long samples() const override {
+            return n_samples;
+        }
+
+        unsigned long variants() const override {
+            return n_snps;
+        }
+
+        void rewind() override {
+            position = 0;
+        }
+
+        unsigned long read(variant_block& block) override {
+            unsigned long count = std::min(block.capacity(), n_snps - position);
+            switch (TYPEOF(gmatrix)) {
+                case INTSXP:
+                    fill_variants(INTEGER(gmatrix), n_snps, position, count, n_samples, block);
+                    break;
+                case REALSXP:
+                    fill_variants(REAL(gmatrix), n_snps, position, count, n_samples, block);
+                    break;
+                default:
+                    fill_variants(RAW(gmatrix), n_snps, position, count, n_samples, block);
+            }
+            position += count;
+            return count;
+        }
+    };
+
+    vector<vector<int>> read_counts(const NumericMatrix& cc) {
+        vector<vector<int>> case_counts(cc.nrow(), vector<int>(3));
+        for (int i = 0; i < cc.nrow(); i++) {
+            for (int j = 0; j < 3; j++) {
+                case_counts[i][j] = (int)std::lround(cc(i, j));
+            }
+        }
+        return case_counts;
+    }
+
+    vector<int> control_order(const NumericVector& residuals, const genotype_rows& rows) {
+        if (residuals.length() != rows.controls()) {
+            stop("Number of residuals doesn't match the number of controls");
+        }
+        return residual_order(vector<double>(residuals.begin(), residuals.end()));
+    }
+
+    basis read_basis(NumericMatrix& u, int n_sv, SEXP gmatrix) {
+        if (u.nrow() != Rf_nrows(gmatrix)) {
+            stop("Reference basis and genotype matrix have different number of variants");
+        }
+        if (n_sv < 1 || n_sv > u.ncol()) {
+            stop("Number of singular vectors must be between 1 and the number of columns of the basis");
+        }
+        return {u.begin(), (unsigned long)n_sv};
+    }
+
+    List svd_list(genotype_source& source, int k, int oversampling, int power_iterations, int threads) {
+        unsigned long l = std::min((unsigned long)(k + oversampling), std::min(source.variants(), source.samples()));
+        if (k < 1 || (unsigned long)k > l) {
+            stop("k must be between 1 and the smallest dimension of the matrix");
+        }
+        NumericVector omega = rnorm((int)(source.samples() * l));
+        svd_result result = truncated_svd(source, k, omega.begin(), l, power_iterations,
+                thread_pool::resolve_threads(threads));
+        List ret;
+        ret["d"] = NumericVector(result.d.begin(), result.d.end());
+        ret["u"] = NumericMatrix((int)source.variants(), k, result.u.data());
+        return ret;
+    }
+
+    List result_list(const matching_results& result) {
+        List ret;
+        NumericVector lambda(result.lambdas.begin(), result.lambdas.end());
+        IntegerVector n_controls(1, result.optimal_prefix);
+        NumericVector pvals(result.pvals.begin(), result.pvals.end());
+        NumericVector optimal_lambda(1, result.optimal_lambda);
+        IntegerVector names(result.lambda_i.begin(), result.lambda_i.end());
+        IntegerVector pvals_num(result.pvals_num.begin(), result.pvals_num.end());
+        lambda.attr("names") = names;
+        pvals_num.attr("names") = names;
+        ret["lambda"] = lambda;
+        ret["controls"] = n_controls;
+        ret["pvals"] = pvals;
+        ret["optimal_lambda"] = optimal_lambda;
+        ret["snps"] = pvals_num;
+        return ret;
+    }
+}
+
 // [[Rcpp::export]]
-List select_controls_cpp(NumericMatrix& gmatrix, NumericVector& residuals,
-                     NumericMatrix& cc, NumericVector& chi2fn,
+List select_controls_cpp(SEXP gmatrix, NumericVector& residuals,
+                     NumericMatrix& cc,
                      NumericVector min_lambda, NumericVector lb_lambda,
                      NumericVector max_lambda, NumericVector ub_lambda, IntegerVector min,
-                     IntegerVector bin_size) {
-    int n_c = gmatrix.ncol();
-    int n_snps = gmatrix.nrow();
-    vector<double> precomputed_chi(chi2fn.length());
-    for (int i = 0; i < precomputed_chi.size(); i++) {
-        precomputed_chi[i] = chi2fn[i];
+                     IntegerVector bin_size, IntegerVector threads,
+                     IntegerVector snapshot_step, LogicalVector adaptive) {
+    int n_threads = thread_pool::resolve_threads(threads[0]);
+    genotype_rows rows = read_genotypes(gmatrix);
+    vector<int> order = control_order(residuals, rows);
+    vector<vector<int>> case_counts = read_counts(cc);
+    int min_controls = min[0];
+    int bin = bin_size[0];
+    auto result = select_controls_impl(rows, order, case_counts, min_lambda[0], lb_lambda[0],
+            max_lambda[0], ub_lambda[0], min_controls, bin, n_threads,
+            snapshot_step[0], adaptive[0]);
+    return result_list(result);
+}
+
+// [[Rcpp::export]]
+List select_controls_batch_cpp(SEXP gmatrix, List bases, IntegerVector n_sv, List cc,
+                     NumericVector min_lambda, NumericVector lb_lambda,
+                     NumericVector max_lambda, NumericVector ub_lambda, IntegerVector min,
+                     IntegerVector bin_size, IntegerVector threads,
+                     IntegerVector snapshot_step, LogicalVector adaptive) {
+    if (bases.size() != cc.size()) {
+        stop("Every cohort needs a reference basis and case counts");
     }
-    qchi2 q(precomputed_chi);
+    int n_threads = thread_pool::resolve_threads(threads[0]);
+    genotype_rows rows = read_genotypes(gmatrix);
+    // Residual norms of all cohorts in one pass over imputed genotypes,
+    // selection counts the genotypes as they are.
+    genotype_rows imputed = rows;
+    impute(imputed, Rf_nrows(gmatrix), n_threads);
+    vector<NumericMatrix> matrices;
+    vector<basis> references;
+    for (int m = 0; m < bases.size(); m++) {
+        matrices.push_back(bases[m]);
+        references.push_back(read_basis(matrices.back(), n_sv[0], gmatrix));
+    }
+    vector<double> norms = residual_norms(imputed, references, Rf_nrows(gmatrix), n_threads);
+    unsigned long n = rows.controls();
+    List results(bases.size());
+    List orders(bases.size());
+    for (int m = 0; m < bases.size(); m++) {
+        auto first = norms.begin() + ((unsigned long)(m + 1) * n_sv[0] - 1) * n;
+        vector<int> order = residual_order(vector<double>(first, first + n));
+        NumericMatrix cohort_cc = cc[m];
+        vector<vector<int>> case_counts = read_counts(cohort_cc);
+        auto result = select_controls_impl(rows, order, case_counts, min_lambda[0], lb_lambda[0],
+                max_lambda[0], ub_lambda[0], min[0], bin_size[0], n_threads,
+                snapshot_step[0], adaptive[0]);
+        results[m] = result_list(result);
+        IntegerVector ranked(n);
+        for (unsigned long i = 0; i < n; i++) {
+            ranked[i] = order[i] + 1;
+        }
+        orders[m] = ranked;
+    }
+    return List::create(Named("results") = results, Named("orders") = orders);
+}
 
-    vector<vector<int>> gmatrix_c(n_c, vector<int>(n_snps));
-    vector<vector<int>> case_counts(n_snps, vector<int>(3));
-    vector<double> resid(n_c);
+// [[Rcpp::export]]
+NumericMatrix residual_norms_cpp(SEXP gmatrix, NumericMatrix& u, IntegerVector n_sv,
+                     IntegerVector threads) {
+    int n_threads = thread_pool::resolve_threads(threads[0]);
+    genotype_rows rows = read_imputed_genotypes(gmatrix, n_threads);
+    basis reference = read_basis(u, n_sv[0], gmatrix);
+    vector<double> norms = residual_norms(rows, {reference}, u.nrow(), n_threads);
+    return NumericMatrix((int)rows.controls(), n_sv[0], norms.data());
+}
+
+// [[Rcpp::export]]
+IntegerVector predict_ancestry_cpp(SEXP gmatrix, List bases, IntegerVector n_sv,
+                     IntegerVector threads) {
+    int n_threads = thread_pool::resolve_threads(threads[0]);
+    genotype_rows rows = read_imputed_genotypes(gmatrix, n_threads);
+    vector<NumericMatrix> matrices;
+    vector<basis> references;
+    for (int m = 0; m < bases.size(); m++) {
+        matrices.push_back(bases[m]);
+        references.push_back(read_basis(matrices.back(), n_sv[0], gmatrix));
+    }
+    vector<double> norms = residual_norms(rows, references, Rf_nrows(gmatrix), n_threads);
+    unsigned long n = rows.controls();
+    // Norm of sample i with all n_sv vectors of basis m.
+    auto norm = [&](int m, unsigned long i) {
+        return norms[((unsigned long)(m + 1) * n_sv[0] - 1) * n + i];
+    };
+    IntegerVector nearest(n);
+    for (unsigned long i = 0; i < n; i++) {
+        int best = 0;
+        for (int m = 1; m < bases.size(); m++) {
+            if (norm(m, i) < norm(best, i)) {
+                best = m;
+            }
+        }
+        nearest[i] = best + 1;
+    }
+    return nearest;
+}
+
+// [[Rcpp::export]]
+List truncated_svd_cpp(SEXP gmatrix, IntegerVector k, IntegerVector oversampling,
+                     IntegerVector power_iterations, IntegerVector threads) {
+    if (!Rf_isMatrix(gmatrix)) {
+        stop("Genotype matrix must be a matrix");
+    }
+    if (TYPEOF(gmatrix) != INTSXP && TYPEOF(gmatrix) != REALSXP && TYPEOF(gmatrix) != RAWSXP) {
+        stop("Genotype matrix must be integer, numeric or raw");
+    }
+    matrix_source source(gmatrix);
+    return svd_list(source, k[0], oversampling[0], power_iterations[0], threads[0]);
+}
 
-    for (int i = 0; i < n_c; i++) {
-        resid[i] = residuals[i];
-        for (int j = 0; j < gmatrix.nrow(); j++) {
-            gmatrix_c[i][j] = (int)std::lround(gmatrix(j, i));
+// [[Rcpp::export]]
+List truncated_svd_file_cpp(CharacterVector prefix, CharacterVector format, IntegerVector k,
+                     IntegerVector oversampling, IntegerVector power_iterations,
+                     IntegerVector threads) {
+    try {
+        std::unique_ptr<genotype_source> file;
+        if (std::string(format[0]) == "bed") {
+            file.reset(new bed_source(std::string(prefix[0])));
+        } else {
+            file.reset(new binary_source(std::string(prefix[0])));
         }
+        prefetching_source source(*file);
+        return svd_list(source, k[0], oversampling[0], power_iterations[0], threads[0]);
+    } catch (vcf::ParserException& e) {
+        stop(e.get_message());
+    }
+}
+
+// [[Rcpp::export]]
+SEXP replace_missing_cpp(SEXP gmatrix, IntegerVector threads) {
+    if (!Rf_isMatrix(gmatrix)) {
+        stop("Genotype matrix must be a matrix");
     }
-    for (int i = 0; i < n_snps; i++) {
-        for (int j = 0; j < 3; j++) {
-            case_counts[i][j] = (int)std::lround(cc(i, j));
+    int n_threads = thread_pool::resolve_threads(threads[0]);
+    unsigned long n_snps = Rf_nrows(gmatrix);
+    unsigned long n_samples = Rf_ncols(gmatrix);
+    switch (TYPEOF(gmatrix)) {
+        case INTSXP: {
+            IntegerMatrix imputed = clone(IntegerMatrix(gmatrix));
+            auto is_missing = [](int value) {
+                return value == NA_INTEGER;
+            };
+            impute_sample_major(imputed.begin(), n_snps, n_samples, is_missing, n_threads);
+            return imputed;
+        }
+        case REALSXP: {
+            NumericMatrix imputed = clone(NumericMatrix(gmatrix));
+            auto is_missing = [](double value) {
+                return std::isnan(value);
+            };
+            impute_sample_major(imputed.begin(), n_snps, n_samples, is_missing, n_threads);
+            return imputed;
         }
+        case RAWSXP:
+            return gmatrix;
+        default:
+            stop("Genotype matrix must be integer, numeric or raw");
     }
-    int min_controls = min[0];
-    int bin = bin_size[0];
-    std::function<double(double)> qchi = q.function();
-    auto result = select_controls_impl(gmatrix_c, resid, case_counts, qchi, min_lambda[0], lb_lambda[0],
-            max_lambda[0], ub_lambda[0], min_controls, bin);
-    List ret;
-    NumericVector lambda(result.lambdas.begin(), result.lambdas.end());
-    IntegerVector n_controls(1, result.optimal_prefix);
-    NumericVector pvals(result.pvals.begin(), result.pvals.end());
-    NumericVector optimal_lambda(1, result.optimal_lambda);
-    IntegerVector names(result.lambda_i.begin(), result.lambda_i.end());
-    IntegerVector pvals_num(result.pvals_num.begin(), result.pvals_num.end());
-    lambda.attr("names") = names;
-    pvals_num.attr("names") = names;
-    ret["lambda"] = lambda;
-    ret["controls"] = n_controls;
-    ret["pvals"] = pvals;
-    ret["optimal_lambda"] = optimal_lambda;
-    ret["snps"] = pvals_num;
-    return ret;
 }
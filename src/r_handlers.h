@@ -0,0 +1,133 @@
+#ifndef SRC_R_HANDLERS_H
+#define SRC_R_HANDLERS_H
+
+#include <Rcpp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "vcf_handlers.h"
+
+// Handlers converting collected data into R objects. Conversion must be
+// done on the main thread.
+namespace vcf {
+    class RGenotypeMatrixHandler: public GenotypeMatrixHandler {
+    public:
+        using GenotypeMatrixHandler::GenotypeMatrixHandler;
+
+        Rcpp::IntegerMatrix result() {
+            return result(gmatrix.size());
+        }
+
+        // Converts the first n rows and drops them from the handler.
+        Rcpp::IntegerMatrix result(unsigned long n) {
+            n = std::min(n, (unsigned long)gmatrix.size());
+            Rcpp::IntegerMatrix res(n, samples.size());
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < samples.size(); j++) {
+                    int val = gmatrix[i][j];
+                    if (val == MISSING) {
+                        val = NA_INTEGER;
+                    }
+                    res[j * n + i] = val;
+                }
+            }
+            std::vector<std::string> row_names;
+            std::for_each(variants.begin(), variants.begin() + n, [&row_names](Variant& v){
+                row_names.push_back((std::string)v);
+            });
+            Rcpp::rownames(res) = Rcpp::CharacterVector(row_names.begin(), row_names.end());
+            gmatrix.erase(gmatrix.begin(), gmatrix.begin() + n);
+            variants.erase(variants.begin(), variants.begin() + n);
+            return res;
+        }
+    };
+
+    class RSparseGenotypeMatrixHandler: public SparseGenotypeMatrixHandler {
+    public:
+        using SparseGenotypeMatrixHandler::SparseGenotypeMatrixHandler;
+
+        // Column-compressed variants x samples matrix with 0-based row
+        // indices, the layout of dgCMatrix from the Matrix package.
+        Rcpp::List result() {
+            unsigned long n = variants.size();
+            unsigned long n_samples = samples.size();
+            Rcpp::IntegerVector p(n_samples + 1);
+            for (int column: columns) {
+                ++p[column + 1];
+            }
+            for (unsigned long j = 0; j < n_samples; j++) {
+                p[j + 1] += p[j];
+            }
+            std::vector<int> next(p.begin(), p.end() - 1);
+            Rcpp::IntegerVector i(columns.size());
+            Rcpp::NumericVector x(columns.size());
+            unsigned long start = 0;
+            for (unsigned long row = 0; row < n; row++) {
+                for (unsigned long k = start; k < row_end[row]; k++) {
+                    int at = next[columns[k]]++;
+                    i[at] = (int)row;
+                    x[at] = values[k] == MISSING ? NA_REAL : values[k];
+                }
+                start = row_end[row];
+            }
+            std::vector<std::string> row_names;
+            for (const Variant& v: variants) {
+                row_names.push_back((std::string)v);
+            }
+            return Rcpp::List::create(Rcpp::Named("i") = i, Rcpp::Named("p") = p, Rcpp::Named("x") = x,
+                                      Rcpp::Named("dim") = Rcpp::IntegerVector::create((int)n, (int)n_samples),
+                                      Rcpp::Named("rownames") = Rcpp::CharacterVector(row_names.begin(),
+                                                                                      row_names.end()));
+        }
+    };
+
+    class RCallRateHandler: public CallRateHandler {
+    public:
+        using CallRateHandler::CallRateHandler;
+
+        Rcpp::NumericMatrix result() {
+            Rcpp::NumericMatrix result(ranges.size(), samples.size());
+            for (int i = 0; i < ranges.size(); i++) {
+                for (int j = 0; j < samples.size(); j++) {
+                    result[j * ranges.size() + i] = (double)call_rate_matrix[i][j] / n_variants[i];
+                }
+            }
+            return result;
+        }
+    };
+
+    class RGenotypeCountsHandler: public GenotypeCountsHandler {
+    public:
+        using GenotypeCountsHandler::GenotypeCountsHandler;
+
+        Rcpp::DataFrame result() {
+            unsigned long n = counts.size();
+            Rcpp::CharacterVector var(n);
+            Rcpp::CharacterVector ref(n);
+            Rcpp::CharacterVector alt(n);
+            Rcpp::IntegerVector homref(n);
+            Rcpp::IntegerVector het(n);
+            Rcpp::IntegerVector hom(n);
+            Rcpp::IntegerVector missing(n);
+            Rcpp::NumericVector callrate(n);
+            for (int i = 0; i < n; i++) {
+                var[i] = (std::string)variants[i].position();
+                ref[i] = variants[i].reference();
+                alt[i] = variants[i].alternative();
+                homref[i] = counts[i][HOMREF];
+                het[i] = counts[i][HET];
+                hom[i] = counts[i][HOM];
+                missing[i] = counts[i][MISSING];
+                callrate[i] = samples.empty() ? 0.0 : 1.0 - (double)counts[i][MISSING] / samples.size();
+            }
+            return Rcpp::DataFrame::create(Rcpp::Named("VAR") = var, Rcpp::Named("REF") = ref,
+                                           Rcpp::Named("ALT") = alt, Rcpp::Named("REFHOM") = homref,
+                                           Rcpp::Named("HET") = het, Rcpp::Named("ALTHOM") = hom,
+                                           Rcpp::Named("MISSING") = missing, Rcpp::Named("CALLRATE") = callrate,
+                                           Rcpp::Named("stringsAsFactors") = false);
+        }
+    };
+}
+
+#endif //SRC_R_HANDLERS_H
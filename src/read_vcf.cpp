@@ -4,17 +4,25 @@
 #include <string>
 
 #include "vcf_primitives.h"
+#include "r_handlers.h"
+#include "vcf_pipeline.h"
 
 namespace {
     using Rcpp::CharacterVector;
     using Rcpp::IntegerVector;
+    using Rcpp::LogicalVector;
+    using Rcpp::List;
 
     using std::string;
     using std::vector;
     using std::unordered_set;
 
     using vcf::Variant;
+    using vcf::Allele;
+    using vcf::AlleleType;
     using vcf::AlleleBinary;
+    using vcf::ParserException;
+    using vcf::VariantsHandler;
 
     vector<string> parse_samples(std::istream& in) {
         vector<string> samples;
@@ -43,4 +51,64 @@ namespace {
         return variants;
     }
 
+    // Replays genotypes stored by BinaryFileHandler, metadata is read
+    // line by line along with the corresponding binary record.
+    void scan_binary(std::istream& meta, std::istream& binary, unsigned long n_samples,
+                     VariantsHandler& handler) {
+        vector<AlleleBinary> record(n_samples);
+        vector<Allele> alleles;
+        string line;
+        while (getline(meta, line)) {
+            if (std::all_of(line.begin(), line.end(), isspace)) {
+                continue;
+            }
+            vector<Variant> variants = Variant::parseVariants(line);
+            binary.read(reinterpret_cast<char*>(record.data()), sizeof(AlleleBinary) * n_samples);
+            if (variants.size() != 1 || !binary) {
+                throw ParserException("Binary file doesn't match its metadata at variant " + line);
+            }
+            alleles.clear();
+            for (const AlleleBinary& allele: record) {
+                alleles.emplace_back((AlleleType)allele.allele, allele.DP, allele.GQ);
+            }
+            handler.processVariant(variants[0], alleles);
+        }
+    }
+}
+
+// [[Rcpp::export]]
+List parse_binary(const CharacterVector& binary_prefix, const LogicalVector& ret_gmatrix,
+                  const LogicalVector& ret_counts) {
+    List ret;
+    try {
+        string prefix = string(binary_prefix[0]);
+        std::ifstream meta(prefix + "_meta");
+        std::ifstream binary(prefix + "_bin", std::ios::binary);
+        if (!meta || !binary) {
+            throw ParserException("Can't open binary files with prefix " + prefix);
+        }
+        vector<string> samples = parse_samples(meta);
+
+        std::shared_ptr<vcf::RGenotypeMatrixHandler> gmatrix_handler;
+        std::shared_ptr<vcf::RGenotypeCountsHandler> counts_handler;
+        if (ret_gmatrix[0]) {
+            gmatrix_handler.reset(new vcf::RGenotypeMatrixHandler(samples));
+        }
+        if (ret_counts[0]) {
+            counts_handler.reset(new vcf::RGenotypeCountsHandler(samples));
+        }
+        auto handler = vcf::compose(samples, gmatrix_handler, counts_handler);
+        scan_binary(meta, binary, samples.size(), *handler);
+
+        ret["samples"] = CharacterVector(samples.begin(), samples.end());
+        if (ret_gmatrix[0]) {
+            ret["genotype"] = gmatrix_handler->result();
+        }
+        if (ret_counts[0]) {
+            ret["counts"] = counts_handler->result();
+        }
+    } catch (ParserException& e) {
+        ::Rf_error(e.get_message().c_str());
+    }
+    return ret;
 }
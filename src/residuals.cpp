@@ -0,0 +1,106 @@
+#include "residuals.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // A block of U of SNP_BLOCK x k doubles stays in cache while it is
+    // multiplied by CONTROL_BLOCK rows of genotypes.
+    const unsigned long SNP_BLOCK = 2048;
+    const unsigned long CONTROL_BLOCK = 64;
+}
+
+std::vector<double> residual_norms(const genotype_rows& gmatrix, const std::vector<basis>& bases,
+                                   unsigned long n_snps, int threads) {
+    // Offsets of the bases among the stacked columns and in the Gram blocks.
+    std::vector<unsigned long> offset(1, 0);
+    std::vector<unsigned long> gram_offset(1, 0);
+    for (const basis& b: bases) {
+        offset.push_back(offset.back() + b.k);
+        gram_offset.push_back(gram_offset.back() + b.k * b.k);
+    }
+    unsigned long k = offset.back();
+
+    // Row-major copy of all bases: the k coordinates of a SNP are contiguous.
+    std::vector<double> rows(n_snps * k);
+    for (unsigned long m = 0; m < bases.size(); m++) {
+        for (unsigned long c = 0; c < bases[m].k; c++) {
+            const double* column = bases[m].u + c * n_snps;
+            for (unsigned long j = 0; j < n_snps; j++) {
+                rows[j * k + offset[m] + c] = column[j];
+            }
+        }
+    }
+    // |UU^T z|^2 = y^T (U^T U) y for y = U^T z, so columns of U don't have
+    // to be orthonormal.
+    std::vector<double> gram(gram_offset.back());
+    for (unsigned long m = 0; m < bases.size(); m++) {
+        unsigned long km = bases[m].k;
+        double* g = &gram[gram_offset[m]];
+        for (unsigned long j = 0; j < n_snps; j++) {
+            const double* uj = &rows[j * k + offset[m]];
+            for (unsigned long a = 0; a < km; a++) {
+                for (unsigned long b = 0; b <= a; b++) {
+                    g[a * km + b] += uj[a] * uj[b];
+                }
+            }
+        }
+    }
+
+    unsigned long n = gmatrix.controls();
+    std::vector<double> norms(n * k);
+    thread_pool pool(threads);
+    int n_tasks = pool.size();
+    pool.run(n_tasks, [&](int task) {
+        unsigned long from = n * task / n_tasks;
+        unsigned long to = n * (task + 1) / n_tasks;
+        std::vector<double> proj(CONTROL_BLOCK * k);
+        std::vector<unsigned long> squares(CONTROL_BLOCK);
+        for (unsigned long block = from; block < to; block += CONTROL_BLOCK) {
+            unsigned long block_end = std::min(to, block + CONTROL_BLOCK);
+            std::fill(proj.begin(), proj.end(), 0.0);
+            std::fill(squares.begin(), squares.end(), 0);
+            for (unsigned long snp_block = 0; snp_block < n_snps; snp_block += SNP_BLOCK) {
+                unsigned long snp_end = std::min(n_snps, snp_block + SNP_BLOCK);
+                for (unsigned long i = block; i < block_end; i++) {
+                    const unsigned char* z = gmatrix.row(i);
+                    double* y = &proj[(i - block) * k];
+                    unsigned long square = 0;
+                    for (unsigned long j = snp_block; j < snp_end; j++) {
+                        unsigned int g = z[j];
+                        if (g == 0) {
+                            continue;
+                        }
+                        square += g * g;
+                        const double* uj = &rows[j * k];
+                        for (unsigned long c = 0; c < k; c++) {
+                            y[c] += g * uj[c];
+                        }
+                    }
+                    squares[i - block] += square;
+                }
+            }
+            for (unsigned long i = block; i < block_end; i++) {
+                for (unsigned long m = 0; m < bases.size(); m++) {
+                    unsigned long km = bases[m].k;
+                    const double* y = &proj[(i - block) * k + offset[m]];
+                    const double* g = &gram[gram_offset[m]];
+                    double square = squares[i - block];
+                    double reconstructed = 0;
+                    for (unsigned long a = 0; a < km; a++) {
+                        // Terms of y^T (U^T U) y added by column a.
+                        double cross = 0;
+                        for (unsigned long b = 0; b < a; b++) {
+                            cross += g[a * km + b] * y[b];
+                        }
+                        reconstructed += y[a] * (y[a] * g[a * km + a] + 2 * cross);
+                        square -= 2 * y[a] * y[a];
+                        norms[(offset[m] + a) * n + i] = std::sqrt(std::max(0.0, square + reconstructed));
+                    }
+                }
+            }
+        }
+    });
+    return norms;
+}
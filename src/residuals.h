@@ -0,0 +1,24 @@
+#ifndef SRC_RESIDUALS_H
+#define SRC_RESIDUALS_H
+
+#include <vector>
+
+#include "genotype_rows.h"
+
+// k columns of n_snps values each, column-major.
+struct basis {
+    const double* u;
+    unsigned long k;
+};
+
+// Norms of the residuals (I - UU^T)z of genotype vectors z of all controls
+// for U made of the first 1, 2, ..., k columns of every basis. Returned
+// column-major with a column for every column of every basis: the column of
+// the j-th vector of a basis holds the norms of all controls for its first
+// j + 1 vectors. Computed as |z|^2 - 2|U^T z|^2 + |UU^T z|^2 from the
+// coordinates U^T z in all bases, so that no n_snps x n_snps projection
+// matrix is formed and the genotypes are read once for all bases.
+std::vector<double> residual_norms(const genotype_rows& gmatrix, const std::vector<basis>& bases,
+                                   unsigned long n_snps, int threads = 1);
+
+#endif //SRC_RESIDUALS_H
@@ -0,0 +1,222 @@
+#include "svd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    using std::vector;
+
+    // Genotypes of this many bytes are read from the source at once.
+    const unsigned long BLOCK_BYTES = 1ul << 26;
+    // Rows of a tall matrix of this many samples stay in cache while a block
+    // of variants is processed.
+    const unsigned long SAMPLE_BLOCK = 2048;
+    const int MAX_SWEEPS = 50;
+    const double JACOBI_TOLERANCE = 1e-12;
+    // Columns that lose this share of their norm to orthogonalization are
+    // linearly dependent on the previous ones and are set to zero.
+    const double DEPENDENCE_TOLERANCE = 1e-10;
+
+    // Tall matrices below are row-major with l columns, a row per variant or
+    // per sample, so that the coordinates of a variant or sample are together.
+
+    // y = A x, where A is the variants x samples genotype matrix. Rows of y
+    // of a block of variants are split between tasks.
+    void multiply(genotype_source& source, variant_block& block, const vector<double>& x, unsigned long l,
+                  vector<double>& y, thread_pool& pool) {
+        unsigned long n = source.samples();
+        std::fill(y.begin(), y.end(), 0.0);
+        int n_tasks = pool.size();
+        unsigned long first = 0;
+        unsigned long count;
+        source.rewind();
+        while ((count = source.next(block)) > 0) {
+            pool.run(n_tasks, [&](int task) {
+                unsigned long from = count * task / n_tasks;
+                unsigned long to = count * (task + 1) / n_tasks;
+                for (unsigned long sample_block = 0; sample_block < n; sample_block += SAMPLE_BLOCK) {
+                    unsigned long sample_end = std::min(n, sample_block + SAMPLE_BLOCK);
+                    for (unsigned long r = from; r < to; r++) {
+                        const unsigned char* z = block.row(r);
+                        double* yr = &y[(first + r) * l];
+                        for (unsigned long i = sample_block; i < sample_end; i++) {
+                            unsigned int g = z[i];
+                            if (g == 0) {
+                                continue;
+                            }
+                            const double* xi = &x[i * l];
+                            for (unsigned long c = 0; c < l; c++) {
+                                yr[c] += g * xi[c];
+                            }
+                        }
+                    }
+                }
+            });
+            first += count;
+        }
+    }
+
+    // x = A^T y, accumulated over blocks of variants. Every task owns a
+    // range of samples.
+    void multiply_transposed(genotype_source& source, variant_block& block, const vector<double>& y,
+                             unsigned long l, vector<double>& x, thread_pool& pool) {
+        unsigned long n = source.samples();
+        std::fill(x.begin(), x.end(), 0.0);
+        int n_tasks = pool.size();
+        unsigned long first = 0;
+        unsigned long count;
+        source.rewind();
+        while ((count = source.next(block)) > 0) {
+            pool.run(n_tasks, [&](int task) {
+                unsigned long from = n * task / n_tasks;
+                unsigned long to = n * (task + 1) / n_tasks;
+                for (unsigned long sample_block = from; sample_block < to; sample_block += SAMPLE_BLOCK) {
+                    unsigned long sample_end = std::min(to, sample_block + SAMPLE_BLOCK);
+                    for (unsigned long r = 0; r < count; r++) {
+                        const unsigned char* z = block.row(r);
+                        const double* yr = &y[(first + r) * l];
+                        for (unsigned long i = sample_block; i < sample_end; i++) {
+                            unsigned int g = z[i];
+                            if (g == 0) {
+                                continue;
+                            }
+                            double* xi = &x[i * l];
+                            for (unsigned long c = 0; c < l; c++) {
+                                xi[c] += g * yr[c];
+                            }
+                        }
+                    }
+                }
+            });
+            first += count;
+        }
+    }
+
+    double column_dot(const vector<double>& a, unsigned long rows, unsigned long l,
+                      unsigned long p, unsigned long q) {
+        double dot = 0;
+        for (unsigned long i = 0; i < rows; i++) {
+            dot += a[i * l + p] * a[i * l + q];
+        }
+        return dot;
+    }
+
+    // Modified Gram-Schmidt, applied twice for numerical orthogonality.
+    void orthonormalize(vector<double>& a, unsigned long rows, unsigned long l) {
+        for (unsigned long c = 0; c < l; c++) {
+            double initial = std::sqrt(column_dot(a, rows, l, c, c));
+            for (int pass = 0; pass < 2; pass++) {
+                for (unsigned long b = 0; b < c; b++) {
+                    double dot = column_dot(a, rows, l, b, c);
+                    for (unsigned long i = 0; i < rows; i++) {
+                        a[i * l + c] -= dot * a[i * l + b];
+                    }
+                }
+            }
+            double norm = std::sqrt(column_dot(a, rows, l, c, c));
+            double scale = norm > DEPENDENCE_TOLERANCE * initial ? 1 / norm : 0;
+            for (unsigned long i = 0; i < rows; i++) {
+                a[i * l + c] *= scale;
+            }
+        }
+    }
+
+    // One-sided Jacobi: rotates pairs of columns of x until they are
+    // orthogonal, accumulating the rotations in v (l x l, row-major). Then
+    // x = W S V^T with W S being the rotated x.
+    void jacobi(vector<double>& x, unsigned long rows, unsigned long l, vector<double>& v) {
+        v.assign(l * l, 0.0);
+        for (unsigned long c = 0; c < l; c++) {
+            v[c * l + c] = 1;
+        }
+        for (int sweep = 0; sweep < MAX_SWEEPS; sweep++) {
+            bool rotated = false;
+            for (unsigned long p = 0; p < l; p++) {
+                for (unsigned long q = p + 1; q < l; q++) {
+                    double alpha = column_dot(x, rows, l, p, p);
+                    double beta = column_dot(x, rows, l, q, q);
+                    double gamma = column_dot(x, rows, l, p, q);
+                    if (std::abs(gamma) <= JACOBI_TOLERANCE * std::sqrt(alpha * beta)) {
+                        continue;
+                    }
+                    rotated = true;
+                    double zeta = (beta - alpha) / (2 * gamma);
+                    double t = (zeta >= 0 ? 1 : -1) / (std::abs(zeta) + std::sqrt(1 + zeta * zeta));
+                    double cos = 1 / std::sqrt(1 + t * t);
+                    double sin = cos * t;
+                    auto rotate = [cos, sin, l, p, q](vector<double>& a, unsigned long n_rows) {
+                        for (unsigned long i = 0; i < n_rows; i++) {
+                            double ap = a[i * l + p];
+                            double aq = a[i * l + q];
+                            a[i * l + p] = cos * ap - sin * aq;
+                            a[i * l + q] = sin * ap + cos * aq;
+                        }
+                    };
+                    rotate(x, rows);
+                    rotate(v, l);
+                }
+            }
+            if (!rotated) {
+                break;
+            }
+        }
+    }
+}
+
+svd_result truncated_svd(genotype_source& source, unsigned long k, const double* omega, unsigned long l,
+                         int power_iterations, int threads) {
+    unsigned long m = source.variants();
+    unsigned long n = source.samples();
+    thread_pool pool(threads);
+    variant_block block(std::max(1ul, std::min(m, BLOCK_BYTES / std::max(1ul, n))), n);
+
+    vector<double> x(n * l);
+    for (unsigned long c = 0; c < l; c++) {
+        for (unsigned long i = 0; i < n; i++) {
+            x[i * l + c] = omega[c * n + i];
+        }
+    }
+    // y spans the range of A, x of A^T.
+    vector<double> y(m * l);
+    multiply(source, block, x, l, y, pool);
+    orthonormalize(y, m, l);
+    for (int iteration = 0; iteration < power_iterations; iteration++) {
+        multiply_transposed(source, block, y, l, x, pool);
+        orthonormalize(x, n, l);
+        multiply(source, block, x, l, y, pool);
+        orthonormalize(y, m, l);
+    }
+    // A ~ y B for B = y^T A. With B^T = W S V^T the left singular vectors
+    // of A are y V.
+    multiply_transposed(source, block, y, l, x, pool);
+    vector<double> v;
+    jacobi(x, n, l, v);
+
+    vector<double> s(l);
+    for (unsigned long c = 0; c < l; c++) {
+        s[c] = std::sqrt(column_dot(x, n, l, c, c));
+    }
+    vector<unsigned long> order(l);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&s](unsigned long a, unsigned long b) {
+        return s[a] > s[b];
+    });
+
+    svd_result result;
+    result.u.assign(m * k, 0.0);
+    result.d.resize(k);
+    for (unsigned long c = 0; c < k; c++) {
+        unsigned long col = order[c];
+        result.d[c] = s[col];
+        for (unsigned long j = 0; j < m; j++) {
+            double value = 0;
+            for (unsigned long b = 0; b < l; b++) {
+                value += y[j * l + b] * v[b * l + col];
+            }
+            result.u[c * m + j] = value;
+        }
+    }
+    return result;
+}
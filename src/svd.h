@@ -0,0 +1,22 @@
+#ifndef SRC_SVD_H
+#define SRC_SVD_H
+
+#include <vector>
+
+#include "genotype_source.h"
+
+struct svd_result {
+    // variants x k, column-major.
+    std::vector<double> u;
+    std::vector<double> d;
+};
+
+// Randomized truncated SVD (Halko, Martinsson, Tropp, 2011) of the
+// variants x samples genotype matrix. omega holds samples x l standard
+// normal values (column-major), l >= k columns of the sketch including
+// oversampling. Every power iteration costs two more passes over the source.
+// Besides a block of the source, memory is O((variants + samples) * l).
+svd_result truncated_svd(genotype_source& source, unsigned long k, const double* omega, unsigned long l,
+                         int power_iterations, int threads = 1);
+
+#endif //SRC_SVD_H
@@ -0,0 +1,94 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(int threads)
+        :task(nullptr), n_tasks(0), next_task(0), finished(0), generation(0), stopping(false) {
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back([this](){ work(); });
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+}
+
+int thread_pool::size() const {
+    return (int)workers.size() + 1;
+}
+
+int thread_pool::resolve_threads(int requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void thread_pool::run_tasks(std::unique_lock<std::mutex>& lock) {
+    while (next_task < n_tasks) {
+        int i = next_task++;
+        lock.unlock();
+        try {
+            (*task)(i);
+        } catch (...) {
+            lock.lock();
+            if (!error) {
+                error = std::current_exception();
+            }
+            lock.unlock();
+        }
+        lock.lock();
+        if (++finished == n_tasks) {
+            task_done.notify_all();
+        }
+    }
+}
+
+void thread_pool::work() {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        task_ready.wait(lock, [this, seen](){ return stopping || generation != seen; });
+        if (stopping) {
+            return;
+        }
+        seen = generation;
+        run_tasks(lock);
+    }
+}
+
+void thread_pool::run(int tasks, const std::function<void(int)>& fn) {
+    if (tasks <= 0) {
+        return;
+    }
+    if (workers.empty() || tasks == 1) {
+        for (int i = 0; i < tasks; i++) {
+            fn(i);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &fn;
+    n_tasks = tasks;
+    next_task = 0;
+    finished = 0;
+    error = nullptr;
+    ++generation;
+    task_ready.notify_all();
+    run_tasks(lock);
+    task_done.wait(lock, [this](){ return finished == n_tasks; });
+    task = nullptr;
+    std::exception_ptr failure = error;
+    error = nullptr;
+    lock.unlock();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SRC_THREAD_POOL_H
+#define SRC_THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Fixed set of worker threads executing indexed tasks. The calling thread
+// takes part in every run(), so a pool of size 1 has no workers at all and
+// runs everything inline. Tasks must not call into R.
+class thread_pool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable task_done;
+
+    const std::function<void(int)>* task;
+    int n_tasks;
+    int next_task;
+    int finished;
+    unsigned long generation;
+    bool stopping;
+    std::exception_ptr error;
+
+    void work();
+    void run_tasks(std::unique_lock<std::mutex>& lock);
+public:
+    explicit thread_pool(int threads);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const;
+    void run(int tasks, const std::function<void(int)>& fn);
+
+    static int resolve_threads(int requested);
+};
+
+#endif //SRC_THREAD_POOL_H
@@ -8,8 +8,16 @@
 #include <numeric>
 #include <stdexcept>
 #include <functional>
+#include <map>
+#include <limits>
+#include <deque>
+#include <mutex>
+#include <memory>
 
 #include "lm.h"
+#include "genotype_rows.h"
+#include "qchisq.h"
+#include "thread_pool.h"
 
 using std::vector;
 using std::tuple;
@@ -18,20 +26,15 @@ const double chi2_bdry = 10.82757;
 
 namespace {
 
-void sort_controls(vector<vector<int>>& gmatrix, vector<double>& residuals) {
+// Positions of controls in order of increasing residuals, ties keep their
+// original order as in R's order().
+vector<int> residual_order(const vector<double>& residuals) {
     vector<int> perm(residuals.size());
     std::iota(perm.begin(), perm.end(), 0);
-    std::sort(perm.begin(), perm.end(), [&residuals](int pos_a, int pos_b){
+    std::stable_sort(perm.begin(), perm.end(), [&residuals](int pos_a, int pos_b){
         return residuals[pos_a] < residuals[pos_b];
     });
-    vector<vector<int>> gm;
-    vector<double> sorted_residuals;
-    for (int i = 0; i < residuals.size(); i++) {
-        gm.push_back(std::move(gmatrix[perm[i]]));
-        sorted_residuals.push_back(residuals[perm[i]]);
-    }
-    gmatrix = std::move(gm);
-    residuals = std::move(sorted_residuals);
+    return perm;
 }
 
 double chi2_aux(double obs, double exp) {
@@ -62,11 +65,159 @@ std::vector<bool> check_user_counts(vector<vector<int>>& case_counts) {
     return mask;
 }
 
-double chi2(int k, int n, std::function<double(double)>& qchisq) {
-    double a = n <= 10 ? 3.0 / 8.0 : 0.5;
-    return qchisq((k + 1 - a) / (n + 1 - 2 * a));
+// Expected chi-square quantiles of sorted p-values, computed once per number
+// of p-values and shared between threads. Only the last CAPACITY sizes are
+// kept.
+class expected_quantiles {
+public:
+    struct quantiles {
+        vector<double> x;
+        // The most significant p-value never took part in the lambda fit,
+        // so the sum of squares starts from the second one.
+        double sxx;
+    };
+private:
+    static const unsigned long CAPACITY = 64;
+
+    std::mutex mutex;
+    std::map<unsigned long, std::shared_ptr<const quantiles>> cache;
+    std::deque<unsigned long> order;
+public:
+    std::shared_ptr<const quantiles> get(unsigned long n) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = cache.find(n);
+            if (it != cache.end()) {
+                return it->second;
+            }
+        }
+        std::shared_ptr<quantiles> ret = std::make_shared<quantiles>();
+        ret->x.resize(n);
+        double a = n <= 10 ? 3.0 / 8.0 : 0.5;
+        for (unsigned long j = 0; j < n; j++) {
+            ret->x[j] = (j + 1 - a) / (n + 1 - 2 * a);
+        }
+        qchisq_upper(ret->x.data(), n, ret->x.data());
+        ret->sxx = 0.0;
+        for (unsigned long j = 1; j < n; j++) {
+            ret->sxx += ret->x[j] * ret->x[j];
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cache.emplace(n, ret).second) {
+            order.push_back(n);
+            if (order.size() > CAPACITY) {
+                cache.erase(order.front());
+                order.pop_front();
+            }
+        }
+        return ret;
+    }
+};
+
+// Through-origin fit of observed against expected chi-square statistics,
+// the observed ones are sorted in place from the most significant.
+double estimate_lambda(vector<double>& stats, expected_quantiles& expected) {
+    unsigned long n_stats = stats.size();
+    std::shared_ptr<const expected_quantiles::quantiles> q = expected.get(n_stats);
+    std::sort(stats.begin(), stats.end(), std::greater<double>());
+    double sxy = 0.0;
+    for (unsigned long j = 1; j < n_stats; j++) {
+        sxy += q->x[j] * stats[j];
+    }
+    return sxy / q->sxx;
 }
 
+// Control genotype counts and association models of all SNPs for some
+// prefix of the sorted controls. SNPs masked out are never touched, missing
+// genotypes are left out of both.
+class prefix_state {
+    const vector<bool>& mask;
+    vector<int> counts;
+    vector<snp_regression> models;
+public:
+    prefix_state(const vector<vector<int>>& case_counts, const vector<bool>& mask)
+            :mask(mask), counts(case_counts.size() * 3), models(case_counts.size()) {
+        for (unsigned long j = 0; j < models.size(); j++) {
+            models[j].set_cases(case_counts[j][0], case_counts[j][1], case_counts[j][2]);
+        }
+    }
+
+    void load(const vector<int>& snapshot) {
+        for (unsigned long j = 0; j < models.size(); j++) {
+            if (mask[j]) {
+                const int* cts = &snapshot[3 * j];
+                models[j].add_controls(cts[0], cts[1], cts[2]);
+            }
+        }
+        counts = snapshot;
+    }
+
+    const vector<int>& snapshot() const {
+        return counts;
+    }
+
+    void add(const unsigned char* genotypes, unsigned long from, unsigned long to) {
+        for (unsigned long j = from; j < to; j++) {
+            if (mask[j] && genotypes[j] != genotype_rows::MISSING) {
+                int cur = genotypes[j];
+                ++counts[3 * j + cur];
+                models[j].add_control(cur);
+            }
+        }
+    }
+
+    // Appends chi-square statistics of SNPs that pass the control counts check.
+    // df is for SNPs called in all of the controls, every missing genotype
+    // takes one degree of freedom off. Runs of SNPs with the same df are
+    // converted together.
+    void statistics(double df, int controls, unsigned long from, unsigned long to, vector<double>& ret) {
+        unsigned long start = ret.size();
+        double run_df = df;
+        for (unsigned long j = from; j < to; j++) {
+            const int* cts = &counts[3 * j];
+            if (!mask[j] || !check_counts(cts[0], cts[1], cts[2])) {
+                continue;
+            }
+            double snp_df = df - (controls - cts[0] - cts[1] - cts[2]);
+            if (snp_df != run_df) {
+                chi2_t(ret.data() + start, ret.size() - start, run_df);
+                start = ret.size();
+                run_df = snp_df;
+            }
+            models[j].solve();
+            ret.push_back(models[j].compute_t(snp_df));
+        }
+        chi2_t(ret.data() + start, ret.size() - start, run_df);
+    }
+};
+
+class lambda_selector {
+    double min_lambda;
+    double lb_lambda;
+    double max_lambda;
+    double ub_lambda;
+public:
+    double lambda;
+    int prefix;
+
+    lambda_selector(double min_lambda, double lb_lambda, double max_lambda, double ub_lambda)
+            :min_lambda(min_lambda), lb_lambda(lb_lambda), max_lambda(max_lambda), ub_lambda(ub_lambda),
+             lambda(std::numeric_limits<double>::infinity()), prefix(-1) {}
+
+    bool offer(int cur_prefix, double cur_lambda) {
+        double lambda_dist = std::max(lambda - ub_lambda, lb_lambda - lambda);
+        double cur_lambda_dist = std::max(cur_lambda - ub_lambda, lb_lambda - cur_lambda);
+        if (cur_lambda < max_lambda && cur_lambda > min_lambda) {
+            if ((cur_lambda < ub_lambda && cur_lambda > lb_lambda) || cur_lambda_dist < lambda_dist) {
+                prefix = cur_prefix;
+                lambda = cur_lambda;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
 }
 
 struct matching_results {
@@ -83,87 +234,237 @@ struct matching_results {
             optimal_lambda(opt_lmd), lambda_i(std::move(lmbd_i)), pvals_num(std::move(pvals_number)) {}
 };
 
-matching_results select_controls_impl(vector<vector<int>>& gmatrix, vector<double>& residuals,
-                                                  vector<vector<int>>& case_counts, std::function<double(double)>& qchisq,
+// Number of prefixes in the initial grid of the adaptive search.
+const int ADAPTIVE_GRID = 32;
+
+// Controls are rows of gmatrix taken in the given order of increasing
+// residuals, missing genotypes are not counted. Prefixes of the sorted controls are scanned one after another,
+// SNPs are split between threads. With snapshot_step > 0 control counts of every SNP
+// are first saved each snapshot_step controls and prefixes between two
+// snapshots are then scanned as independent tasks, which scales with the
+// number of prefixes rather than SNPs. Snapshots take 12 * m * n /
+// snapshot_step bytes. Both ways give exactly the same results.
+//
+// The adaptive search evaluates only a grid of ADAPTIVE_GRID prefixes and
+// then halves the step around the optimal prefix until it reaches bin, so
+// only the evaluated prefixes are reported.
+matching_results select_controls_impl(const genotype_rows& gmatrix, const vector<int>& order,
+                                                  vector<vector<int>>& case_counts,
                                                   double min_lambda, double lb_lambda,
                                                   double max_lambda, double ub_lambda,
-                                                  int min_controls = 500, int bin = 1) {
+                                                  int min_controls = 500, int bin = 1, int threads = 1,
+                                                  int snapshot_step = 0, bool adaptive = false) {
     bin = std::max(bin, 1);
     std::vector<bool> snp_mask = check_user_counts(case_counts);
 
-    sort_controls(gmatrix, residuals);
-    unsigned long n = residuals.size();
+    int n = (int)order.size();
     unsigned long m = case_counts.size();
-    std::vector<std::vector<int>> counts(m, vector<int>(3));
-    std::vector<lm> lms;
     unsigned rank = 0;
-    for (int i = 0; i < m; i++) {
-        lm model(6);
-        for (int j = 0; j < 3; j++) {
-            model.set(3 + j, j, 1, case_counts[i][j]);
-            if (i == 0) {
-                rank += case_counts[i][j];
-            }
-        }
-        lms.push_back(model);
+    if (m > 0) {
+        rank = case_counts[0][0] + case_counts[0][1] + case_counts[0][2];
     }
+    auto evaluated = [min_controls, bin](int i) {
+        return i >= min_controls - 1 && (i + 1) % bin == 0;
+    };
+    auto df = [rank](int i) {
+        return rank + i + 1 - 2.0;
+    };
 
-    double lambda = std::numeric_limits<double>::infinity();
+    expected_quantiles expected;
+    lambda_selector selector(min_lambda, lb_lambda, max_lambda, ub_lambda);
     std::vector<double> optimal_pvals;
     std::vector<double> lambdas;
     std::vector<int> lambda_i;
     std::vector<int> pvals_num;
-    int optimal_prefix = -1;
+    auto record = [&](int i, double cur_lambda, unsigned long n_pvals) {
+        lambdas.push_back(cur_lambda);
+        lambda_i.push_back(i + 1);
+        pvals_num.push_back((int)n_pvals);
+        return selector.offer(i + 1, cur_lambda);
+    };
+
+    thread_pool pool(threads);
+    int n_blocks = (int)std::max(1ul, std::min((unsigned long)pool.size(), m));
+    unsigned long block_size = (m + n_blocks - 1) / n_blocks;
+    std::vector<std::vector<double>> block_stats(n_blocks);
+    // Adds controls first..last to the state, contiguous SNP blocks are
+    // processed by different threads. Chi-square statistics at the last
+    // control are put to stats in SNP order if requested.
+    auto advance = [&](prefix_state& state, int first, int last, bool evaluate, std::vector<double>& stats) {
+        pool.run(n_blocks, [&](int block) {
+            unsigned long from = block * block_size;
+            unsigned long to = std::min(m, from + block_size);
+            block_stats[block].clear();
+            for (int i = first; i <= last; i++) {
+                state.add(gmatrix.row(order[i]), from, to);
+            }
+            if (evaluate) {
+                state.statistics(df(last), last + 1, from, to, block_stats[block]);
+            }
+        });
+        stats.clear();
+        for (const std::vector<double>& part: block_stats) {
+            stats.insert(stats.end(), part.begin(), part.end());
+        }
+    };
 
-    for (int i = 0; i < n; i++) {
-        if (i % 100 == 0) {
+    if (snapshot_step <= 0 && !adaptive) {
+        // Segments end either at a prefix where lambda is evaluated
+        // or every 100 controls so that the user can interrupt.
+        prefix_state state(case_counts, snp_mask);
+        std::vector<double> stats;
+        int first = 0;
+        while (first < n) {
             Rcpp::checkUserInterrupt();
+
+            int last = first;
+            while (!evaluated(last) && last + 1 < n && (last + 1) % 100 != 0) {
+                ++last;
+            }
+            advance(state, first, last, evaluated(last), stats);
+            if (!stats.empty()) {
+                double cur_lambda = estimate_lambda(stats, expected);
+                if (record(last, cur_lambda, stats.size())) {
+                    optimal_pvals = stats;
+                }
+            }
+            first = last + 1;
         }
+        pchisq_upper(optimal_pvals.data(), optimal_pvals.size(), optimal_pvals.data());
+        return matching_results(selector.prefix, selector.lambda, std::move(optimal_pvals), std::move(lambdas),
+                                std::move(lambda_i), std::move(pvals_num));
+    }
 
-        ++rank;
-        std::vector<double> pvals;
-        for (int j = 0; j < m; j++) {
-            if (!snp_mask[j]) {
-                continue;
+    // Prefixes that can be evaluated are multiples of bin from min_controls
+    // to n. The adaptive grid step is a multiple of bin as well.
+    int first_prefix = std::max(bin, (min_controls + bin - 1) / bin * bin);
+    int last_prefix = n / bin * bin;
+    if (adaptive) {
+        int n_prefixes = std::max(0, (last_prefix - first_prefix) / bin + 1);
+        snapshot_step = bin * std::max(1, (n_prefixes + ADAPTIVE_GRID - 1) / ADAPTIVE_GRID);
+    }
+
+    int n_snapshots = (n + snapshot_step - 1) / snapshot_step;
+    std::vector<std::vector<int>> snapshots;
+    prefix_state state(case_counts, snp_mask);
+    std::vector<double> unused;
+    for (int s = 0; s < n_snapshots; s++) {
+        Rcpp::checkUserInterrupt();
+        snapshots.push_back(state.snapshot());
+        if (s + 1 < n_snapshots) {
+            advance(state, s * snapshot_step, (s + 1) * snapshot_step - 1, false, unused);
+        }
+    }
+
+    // Lambdas and numbers of SNPs of evaluated prefixes, zero SNPs means
+    // that lambda could not be estimated.
+    std::map<int, std::pair<double, unsigned long>> prefix_lambda;
+    // Evaluates sorted prefixes, those between two snapshots form one task.
+    auto scan = [&](const std::vector<int>& prefixes) {
+        std::vector<std::pair<unsigned long, unsigned long>> tasks;
+        for (unsigned long i = 0; i < prefixes.size(); i++) {
+            if (tasks.empty() || (prefixes[i] - 1) / snapshot_step != (prefixes[tasks.back().first] - 1) / snapshot_step) {
+                tasks.emplace_back(i, i);
             }
-            int cur = gmatrix[i][j];
-            std::vector<int>& cts = counts[j];
-            ++cts[cur];
-            lms[j].set(cur, cur, 0, cts[cur]);
-            if (i >= min_controls - 1 && (i + 1) % bin == 0) {
-                if (!check_counts(cts[0], cts[1], cts[2])) {
-                    continue;
+            tasks.back().second = i + 1;
+        }
+        std::vector<std::pair<double, unsigned long>> results(prefixes.size());
+        auto scan_task = [&](int t) {
+            int s = (prefixes[tasks[t].first] - 1) / snapshot_step;
+            prefix_state local(case_counts, snp_mask);
+            local.load(snapshots[s]);
+            std::vector<double> stats;
+            int i = s * snapshot_step;
+            for (unsigned long k = tasks[t].first; k < tasks[t].second; k++) {
+                for (; i < prefixes[k]; i++) {
+                    local.add(gmatrix.row(order[i]), 0, m);
+                }
+                stats.clear();
+                local.statistics(df(i - 1), i, 0, m, stats);
+                if (!stats.empty()) {
+                    double cur_lambda = estimate_lambda(stats, expected);
+                    results[k] = std::make_pair(cur_lambda, stats.size());
+                }
+            }
+        };
+        for (int t = 0; t < tasks.size(); t += pool.size()) {
+            Rcpp::checkUserInterrupt();
+            int wave = std::min(pool.size(), (int)tasks.size() - t);
+            pool.run(wave, [&](int task) {
+                scan_task(t + task);
+            });
+        }
+        for (unsigned long k = 0; k < prefixes.size(); k++) {
+            prefix_lambda[prefixes[k]] = results[k];
+        }
+    };
+    auto select = [&]() {
+        selector = lambda_selector(min_lambda, lb_lambda, max_lambda, ub_lambda);
+        lambdas.clear();
+        lambda_i.clear();
+        pvals_num.clear();
+        for (const auto& prefix: prefix_lambda) {
+            if (prefix.second.second > 0) {
+                record(prefix.first - 1, prefix.second.first, prefix.second.second);
+            }
+        }
+    };
+
+    std::vector<int> prefixes;
+    for (int p = first_prefix; p <= last_prefix; p += bin) {
+        if (!adaptive || p % snapshot_step == 0 || p == first_prefix || p == last_prefix) {
+            prefixes.push_back(p);
+        }
+    }
+    scan(prefixes);
+    select();
+
+    if (adaptive) {
+        for (int step = snapshot_step; step > bin; ) {
+            // Rounded up, so that every multiple of bin between the focus
+            // and its evaluated neighbours can still be reached.
+            step = (step / bin + 1) / 2 * bin;
+            int focus = selector.prefix;
+            if (focus < 0) {
+                // Nothing passes hard bounds, refine around the prefix
+                // closest to the desired range.
+                double best = std::numeric_limits<double>::infinity();
+                for (unsigned long k = 0; k < lambdas.size(); k++) {
+                    double dist = std::max(lambdas[k] - ub_lambda, lb_lambda - lambdas[k]);
+                    if (dist < best) {
+                        best = dist;
+                        focus = lambda_i[k];
+                    }
                 }
-                lms[j].solve();
-                pvals.push_back(pval_t(lms[j].compute_t(rank - 2), rank - 2));
-            }
-        }
-        unsigned long n_pvals = pvals.size();
-        if (i >= min_controls - 1 && !pvals.empty() && (i + 1) % bin == 0) {
-            lm pvals_lm(n_pvals);
-            std::sort(pvals.begin(), pvals.end());
-            for (int j = 0; j < n_pvals; j++) {
-                pvals_lm.set(j, chi2(j, n_pvals, qchisq), qchisq(pvals[j]), 1, false);
-            }
-            pvals_lm.solve();
-            double cur_lambda = pvals_lm.get_lambda();
-            lambdas.push_back(cur_lambda);
-            lambda_i.push_back(i + 1);
-            pvals_num.push_back(pvals.size());
-            double lambda_dist = std::max(lambda - ub_lambda, lb_lambda - lambda);
-            double cur_lambda_dist = std::max(cur_lambda - ub_lambda, lb_lambda - cur_lambda);
-            if (cur_lambda < max_lambda && cur_lambda > min_lambda) {
-                if ((cur_lambda < ub_lambda && cur_lambda > lb_lambda) || cur_lambda_dist < lambda_dist) {
-                    optimal_prefix = i + 1;
-                    lambda = cur_lambda;
-                    optimal_pvals = pvals;
+            }
+            if (focus < 0) {
+                break;
+            }
+            prefixes.clear();
+            for (int p: {focus - step, focus + step}) {
+                if (p >= first_prefix && p <= last_prefix && !prefix_lambda.count(p)) {
+                    prefixes.push_back(p);
                 }
             }
+            scan(prefixes);
+            select();
+        }
+    }
+
+    if (selector.prefix > 0) {
+        int s = (selector.prefix - 1) / snapshot_step;
+        prefix_state optimal(case_counts, snp_mask);
+        optimal.load(snapshots[s]);
+        for (int i = s * snapshot_step; i < selector.prefix; i++) {
+            optimal.add(gmatrix.row(order[i]), 0, m);
         }
+        optimal.statistics(df(selector.prefix - 1), selector.prefix, 0, m, optimal_pvals);
+        std::sort(optimal_pvals.begin(), optimal_pvals.end(), std::greater<double>());
     }
+    pchisq_upper(optimal_pvals.data(), optimal_pvals.size(), optimal_pvals.data());
 
-    return matching_results(optimal_prefix, lambda, std::move(optimal_pvals), std::move(lambdas), std::move(lambda_i),
-                            std::move(pvals_num));
+    return matching_results(selector.prefix, selector.lambda, std::move(optimal_pvals), std::move(lambdas),
+                            std::move(lambda_i), std::move(pvals_num));
 }
 
 #endif
@@ -1,5 +1,7 @@
 #include "vcf_handlers.h"
 #include <iostream>
+#include <iterator>
+#include <algorithm>
 
 namespace {
     using std::vector;
@@ -8,7 +10,7 @@ namespace {
 namespace vcf {
     VariantsHandler::VariantsHandler(const std::vector<std::string>& samples) :samples(samples){}
 
-    void VariantsHandler::processVariant(Variant variant, std::vector<Allele> alleles) {}
+    void VariantsHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {}
 
     CallRateHandler::CallRateHandler(const std::vector<std::string>& samples, const std::vector<Range>& ranges)
         :VariantsHandler(samples), ranges(ranges) {
@@ -18,27 +20,61 @@ namespace vcf {
         n_variants.resize(ranges.size(), 0);
     }
 
-    void CallRateHandler::processVariant(Variant variant, std::vector<Allele> alleles) {
-        for (int r = 0; r < ranges.size(); r++) {
-            const Range& range = ranges[r];
-            if (range.includes(variant.position())) {
-                n_variants[r]++;
-                for (int i = 0; i < alleles.size(); i++) {
-                    if (alleles[i].alleleType() != MISSING) {
-                        ++call_rate_matrix[r][i];
-                    }
-                }
+    void CallRateHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {
+        process(*this, variant, alleles);
+    }
+
+    void CallRateHandler::merge(const CallRateHandler& other) {
+        for (unsigned long r = 0; r < ranges.size(); r++) {
+            n_variants[r] += other.n_variants[r];
+            for (unsigned long i = 0; i < samples.size(); i++) {
+                call_rate_matrix[r][i] += other.call_rate_matrix[r][i];
             }
         }
     }
 
-    void GenotypeMatrixHandler::processVariant(Variant variant, std::vector<Allele> alleles) {
-        vector<AlleleType> row;
-        for (const Allele& allele: alleles) {
-            row.push_back(allele.alleleType());
+    void GenotypeMatrixHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {
+        process(*this, variant, alleles);
+    }
+
+    void GenotypeMatrixHandler::append(GenotypeMatrixHandler& other) {
+        std::move(other.gmatrix.begin(), other.gmatrix.end(), std::back_inserter(gmatrix));
+        variants.insert(variants.end(), other.variants.begin(), other.variants.end());
+        other.gmatrix.clear();
+        other.variants.clear();
+    }
+
+    unsigned long GenotypeMatrixHandler::size() const {
+        return gmatrix.size();
+    }
+
+    void SparseGenotypeMatrixHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {
+        process(*this, variant, alleles);
+    }
+
+    void SparseGenotypeMatrixHandler::append(SparseGenotypeMatrixHandler& other) {
+        unsigned long offset = columns.size();
+        for (unsigned long end: other.row_end) {
+            row_end.push_back(offset + end);
         }
-        gmatrix.push_back(row);
-        variants.push_back(variant);
+        columns.insert(columns.end(), other.columns.begin(), other.columns.end());
+        values.insert(values.end(), other.values.begin(), other.values.end());
+        variants.insert(variants.end(), other.variants.begin(), other.variants.end());
+        other.row_end.clear();
+        other.columns.clear();
+        other.values.clear();
+        other.variants.clear();
+    }
+
+    void GenotypeCountsHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {
+        process(*this, variant, alleles);
+    }
+
+    void GenotypeCountsHandler::append(GenotypeCountsHandler& other) {
+        counts.insert(counts.end(), other.counts.begin(), other.counts.end());
+        variants.insert(variants.end(), other.variants.begin(), other.variants.end());
+        other.counts.clear();
+        other.variants.clear();
     }
 
     BinaryFileHandler::BinaryFileHandler(const std::vector<std::string>& samples, std::string main_filename,
@@ -50,10 +86,7 @@ namespace vcf {
         meta << "\n";
     }
 
-    void BinaryFileHandler::processVariant(Variant variant, std::vector<Allele> alleles) {
-        meta << (std::string)variant << "\n";
-        for (const Allele& allele: alleles) {
-            binary << AlleleBinary::fromAllele(allele);
-        }
+    void BinaryFileHandler::processVariant(const Variant& variant, const std::vector<Allele>& alleles) {
+        process(*this, variant, alleles);
     }
 }
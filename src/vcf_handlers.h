@@ -4,26 +4,67 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <array>
 #include "vcf_primitives.h"
 
 namespace vcf {
+    // Handlers see each variant in three stages: begin, add for every
+    // sample in order, and end. The stage hooks are not virtual, so a
+    // Pipeline (vcf_pipeline.h) composed of concrete handlers inlines them
+    // into one loop over the samples. processVariant runs the stages of a
+    // single handler for parsers that call handlers one by one.
     class VariantsHandler {
     protected:
         const std::vector<std::string> samples;
 
     public:
         VariantsHandler(const std::vector<std::string>& samples);
-        virtual void processVariant(Variant variant, std::vector<Allele> alleles);
+        virtual ~VariantsHandler() = default;
+        virtual void processVariant(const Variant& variant, const std::vector<Allele>& alleles);
+
+        void begin(const Variant& variant) {}
+        void add(int sample, const Allele& allele) {}
+        void end(const Variant& variant) {}
     };
 
+    template <typename Handler>
+    void process(Handler& handler, const Variant& variant, const std::vector<Allele>& alleles) {
+        handler.begin(variant);
+        int n = (int)alleles.size();
+        for (int i = 0; i < n; i++) {
+            handler.add(i, alleles[i]);
+        }
+        handler.end(variant);
+    }
+
     class CallRateHandler: public VariantsHandler {
     protected:
         const std::vector<Range> ranges;
         std::vector<int> n_variants;
         std::vector<std::vector<int>> call_rate_matrix;
+        std::vector<int> active;
     public:
         CallRateHandler(const std::vector<std::string>& samples, const std::vector<Range>& ranges);
-        void processVariant(Variant variant, std::vector<Allele> alleles) override;
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override;
+        void merge(const CallRateHandler& other);
+
+        void begin(const Variant& variant) {
+            active.clear();
+            for (unsigned long r = 0; r < ranges.size(); r++) {
+                if (ranges[r].includes(variant.position())) {
+                    active.push_back(r);
+                    n_variants[r]++;
+                }
+            }
+        }
+
+        void add(int sample, const Allele& allele) {
+            if (allele.alleleType() != MISSING) {
+                for (int r: active) {
+                    ++call_rate_matrix[r][sample];
+                }
+            }
+        }
     };
 
     class GenotypeMatrixHandler: public VariantsHandler {
@@ -32,7 +73,71 @@ namespace vcf {
         std::vector<Variant> variants;
     public:
         using VariantsHandler::VariantsHandler;
-        void processVariant(Variant variant, std::vector<Allele> alleles) override;
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override;
+        void append(GenotypeMatrixHandler& other);
+        unsigned long size() const;
+
+        void begin(const Variant& variant) {
+            gmatrix.emplace_back();
+            gmatrix.back().reserve(samples.size());
+        }
+
+        void add(int sample, const Allele& allele) {
+            gmatrix.back().push_back(allele.alleleType());
+        }
+
+        void end(const Variant& variant) {
+            variants.push_back(variant);
+        }
+    };
+
+    // Genotype matrix with only genotypes other than HOMREF, kept variant
+    // by variant in compressed sparse rows.
+    class SparseGenotypeMatrixHandler: public VariantsHandler {
+    protected:
+        std::vector<unsigned long> row_end;
+        std::vector<int> columns;
+        std::vector<uint8_t> values;
+        std::vector<Variant> variants;
+    public:
+        using VariantsHandler::VariantsHandler;
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override;
+        void append(SparseGenotypeMatrixHandler& other);
+
+        void add(int sample, const Allele& allele) {
+            if (allele.alleleType() != HOMREF) {
+                columns.push_back(sample);
+                values.push_back((uint8_t)allele.alleleType());
+            }
+        }
+
+        void end(const Variant& variant) {
+            row_end.push_back(columns.size());
+            variants.push_back(variant);
+        }
+    };
+
+    class GenotypeCountsHandler: public VariantsHandler {
+    protected:
+        std::vector<std::array<int, 4>> counts;
+        std::vector<Variant> variants;
+    public:
+        using VariantsHandler::VariantsHandler;
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override;
+        void append(GenotypeCountsHandler& other);
+
+        void begin(const Variant& variant) {
+            counts.emplace_back();
+            counts.back().fill(0);
+        }
+
+        void add(int sample, const Allele& allele) {
+            ++counts.back()[allele.alleleType()];
+        }
+
+        void end(const Variant& variant) {
+            variants.push_back(variant);
+        }
     };
 
     class BinaryFileHandler: public VariantsHandler {
@@ -43,7 +148,15 @@ namespace vcf {
     public:
         BinaryFileHandler(const std::vector<std::string>& samples, std::string main_filename,
                 std::string metadata_file);
-        void processVariant(Variant variant, std::vector<Allele> alleles) override;
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override;
+
+        void begin(const Variant& variant) {
+            meta << (std::string)variant << "\n";
+        }
+
+        void add(int sample, const Allele& allele) {
+            binary << AlleleBinary::fromAllele(allele);
+        }
     };
 }
 
@@ -3,6 +3,9 @@
 #include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <cctype>
+#include <limits>
 
 namespace {
     using namespace vcf;
@@ -12,7 +15,6 @@ namespace {
     using std::string;
     using std::find;
     using std::pair;
-    using std::stoi;
 
     vector<string> split(const string& line, char delim){
         vector<string> result;
@@ -35,15 +37,126 @@ namespace {
         return result;
     }
 
-    Position parse_position(const vector<string>& tokens) {
-        Chromosome chr(tokens[CHROM]);
-        int pos;
-        try {
-            pos = stoi(tokens[POS]);
-        } catch (...) {
-            throw ParserException("Can't read variant position");
+    // Strings taken from one line. Clearing keeps the strings themselves, so
+    // later lines reuse their memory.
+    class Columns {
+        vector<string> values;
+        unsigned long count = 0;
+    public:
+        void clear() {
+            count = 0;
+        }
+
+        void push_back(const char* begin, const char* end) {
+            if (count == values.size()) {
+                values.emplace_back(begin, end);
+            } else {
+                values[count].assign(begin, end);
+            }
+            ++count;
+        }
+
+        unsigned long size() const {
+            return count;
+        }
+
+        const string& operator[](unsigned long i) const {
+            return values[i];
+        }
+
+        vector<string>::const_iterator begin() const {
+            return values.begin();
+        }
+
+        vector<string>::const_iterator end() const {
+            return values.begin() + count;
+        }
+    };
+
+    // Stores the non-empty parts of s separated by delim, like split().
+    void split(const string& s, char delim, Columns& parts) {
+        parts.clear();
+        const char* curr = s.data();
+        const char* end = curr + s.size();
+        while (curr != end) {
+            const char* stop = static_cast<const char*>(std::memchr(curr, delim, end - curr));
+            if (stop == nullptr) {
+                stop = end;
+            }
+            if (stop != curr) {
+                parts.push_back(curr, stop);
+            }
+            curr = stop == end ? end : stop + 1;
+        }
+    }
+
+    // Splits the fixed columns of a line into `fixed` and copies only the
+    // sample columns listed in `wanted` (sorted header indices) into
+    // `genotypes`. Other sample columns are skipped by searching for the next
+    // delimiter, and the rest of the line is not read after the last wanted
+    // column. Empty columns are dropped the same way split() does.
+    void split_columns(const string& line, char delim, const vector<int>& wanted,
+                       Columns& fixed, Columns& genotypes) {
+        fixed.clear();
+        genotypes.clear();
+        const char* curr = line.data();
+        const char* end = curr + line.size();
+        auto next = wanted.begin();
+        int column = 0;
+        while (curr != end && (column <= FORMAT || next != wanted.end())) {
+            const char* stop = static_cast<const char*>(std::memchr(curr, delim, end - curr));
+            if (stop == nullptr) {
+                stop = end;
+            }
+            if (stop != curr) {
+                if (column <= FORMAT) {
+                    fixed.push_back(curr, stop);
+                } else if (column == *next) {
+                    genotypes.push_back(curr, stop);
+                    ++next;
+                }
+                ++column;
+            }
+            curr = stop == end ? end : stop + 1;
+        }
+    }
+
+    // Bounds of one ':'-separated field of a sample column.
+    struct FieldView {
+        const char* begin;
+        const char* end;
+    };
+
+    constexpr long max_of(long a, long b) {
+        return a > b ? a : b;
+    }
+
+    // Reads an integer the way std::stoi and operator>> do: leading
+    // whitespace and a sign are allowed, characters after the digits are
+    // left unread. Returns false if there are no digits or on overflow.
+    bool read_int(const char*& curr, const char* end, int& value) {
+        while (curr != end && std::isspace((unsigned char)*curr)) {
+            ++curr;
+        }
+        bool negative = false;
+        if (curr != end && (*curr == '-' || *curr == '+')) {
+            negative = *curr == '-';
+            ++curr;
+        }
+        if (curr == end || !std::isdigit((unsigned char)*curr)) {
+            return false;
+        }
+        const long long limit = negative ? -(long long)std::numeric_limits<int>::min()
+                                         : std::numeric_limits<int>::max();
+        long long result = 0;
+        for (; curr != end && std::isdigit((unsigned char)*curr); ++curr) {
+            result = result * 10 + (*curr - '0');
+            if (result > limit) {
+                return false;
+            }
         }
-        return {chr, pos};
+        value = (int)(negative ? -result : result);
+        return true;
     }
 
     class Format {
@@ -52,15 +165,25 @@ namespace {
         const string GT_FIELD = "GT" ;
         const string AD_FIELD = "AD";
 
-        const char DELIM_1 = '|';
-        const char DELIM_2 = '/';
+        static const char DELIM = ':';
+        static const char DELIM_1 = '|';
+        static const char DELIM_2 = '/';
+
+        static const char MISSING_GT = '.';
 
-        const char MISSING_GT = '.';
+        // FORMAT layouts with a specialized decoder, named by the leading
+        // fields they start with. GENERIC covers everything else.
+        enum Layout {
+            GENERIC, GT_AD_DP_GQ, GT_DP_GQ, GT_DP, GT
+        };
 
         long depth_pos;
         long qual_pos;
         long genotype_pos;
         long ad_pos;
+        Layout layout;
+        // Field bounds of the current sample for the generic layout.
+        vector<FieldView> fields;
 
         void find_pos(const vector<string>& tokens, const string& field, long& pos) {
             auto position = find(tokens.begin(), tokens.end(), field);
@@ -71,7 +194,11 @@ namespace {
             }
         }
 
-        AlleleType type(int first, int second, int allele) {
+        bool has_layout(long gt, long ad, long dp, long gq) const {
+            return genotype_pos == gt && ad_pos == ad && depth_pos == dp && qual_pos == gq;
+        }
+
+        static AlleleType type(int first, int second, int allele) {
             if (first > second) {
                 std::swap(first, second);
             }
@@ -89,70 +216,228 @@ namespace {
             return MISSING;
         }
 
-    public:
-        Format(const string& format) {
-            vector<string> parts = split(format, ':');
-            find_pos(parts, DP_FIELD, depth_pos);
-            find_pos(parts, GQ_FIELD, qual_pos);
-            find_pos(parts, AD_FIELD, ad_pos);
-            find_pos(parts, GT_FIELD, genotype_pos);
-            if (genotype_pos == -1) {
-                throw ParserException("No GT field available for a variant");
-            }
-        }
-
-        AlleleType parse_gt(const string gt, int allele){
-            if (find(gt.begin(), gt.end(), MISSING_GT) != gt.end()) {
+        // Reads a call the way operator>> did: an allele, optionally followed
+        // by a delimiter and the second allele.
+        static AlleleType parse_gt(const FieldView& gt, int allele, bool& error) {
+            if (find(gt.begin, gt.end, MISSING_GT) != gt.end) {
                 return MISSING;
             }
+            const char* curr = gt.begin;
             int first_allele, second_allele;
-            std::istringstream iss(gt);
-            iss >> first_allele;
-            if (iss.eof()) {
+            if (!read_int(curr, gt.end, first_allele)) {
+                error = true;
+                return MISSING;
+            }
+            if (curr == gt.end) {
                 if (first_allele == 0) {
                     return HOMREF;
                 }
                 return first_allele == allele ? HOM : MISSING;
             }
-            char ch;
-            iss >> ch;
-            if (ch != DELIM_1 && ch != DELIM_2) {
-                throw ParserException("Wrong GT format");
+            while (curr != gt.end && std::isspace((unsigned char)*curr)) {
+                ++curr;
+            }
+            if (curr == gt.end || (*curr != DELIM_1 && *curr != DELIM_2)) {
+                error = true;
+                return MISSING;
             }
-            iss >> second_allele;
-            if (iss.fail()) {
-                throw ParserException("Wrong GT format");
+            ++curr;
+            if (!read_int(curr, gt.end, second_allele)) {
+                error = true;
+                return MISSING;
             }
             return type(first_allele, second_allele, allele);
         }
 
-        Allele parse(const string& genotype, int allele, const VCFFilter& filter) {
-            vector<string> parts = split(genotype, ':');
-            try {
-                string gt = parts[genotype_pos];
-                if (gt == "." || gt == "./.") {
-                    return {MISSING, 0, 0};
+        // Single-digit haploid and diploid calls are decoded directly, the
+        // rest goes through parse_gt.
+        static AlleleType decode_gt(const FieldView& gt, int allele, bool& error) {
+            long length = gt.end - gt.begin;
+            const char* c = gt.begin;
+            if (length == 3 && std::isdigit((unsigned char)c[0]) && std::isdigit((unsigned char)c[2])
+                    && (c[1] == DELIM_1 || c[1] == DELIM_2)) {
+                return type(c[0] - '0', c[2] - '0', allele);
+            }
+            if (length == 1 && std::isdigit((unsigned char)c[0])) {
+                int first_allele = c[0] - '0';
+                if (first_allele == 0) {
+                    return HOMREF;
                 }
-                if (ad_pos != -1) {
-                    std::istringstream adstream(parts[ad_pos]);
-                    int ref, alt;
-                    char ch;
-                    adstream >> ref >> ch >> alt;
-                    if (!adstream.fail()) {
-                        double ratio = ref / (double)(ref + alt);
-                        if (ratio < 0.3 || ratio > 0.7) {
-                            return {MISSING, 0, 0};
-                        }
-                    }
+                return first_allele == allele ? HOM : MISSING;
+            }
+            return parse_gt(gt, allele, error);
+        }
+
+        static bool is_missing(const FieldView& gt) {
+            long length = gt.end - gt.begin;
+            return (length == 1 && gt.begin[0] == MISSING_GT) ||
+                   (length == 3 && gt.begin[0] == MISSING_GT && gt.begin[1] == DELIM_2 && gt.begin[2] == MISSING_GT);
+        }
+
+        // True if the AD field holds two readable counts with a reference
+        // fraction outside [0.3, 0.7]. Unreadable AD values are ignored.
+        static bool unbalanced(const FieldView& ad) {
+            const char* curr = ad.begin;
+            int ref, alt;
+            if (!read_int(curr, ad.end, ref)) {
+                return false;
+            }
+            while (curr != ad.end && std::isspace((unsigned char)*curr)) {
+                ++curr;
+            }
+            if (curr == ad.end) {
+                return false;
+            }
+            ++curr;
+            if (!read_int(curr, ad.end, alt)) {
+                return false;
+            }
+            double ratio = ref / (double)(ref + alt);
+            return ratio < 0.3 || ratio > 0.7;
+        }
+
+        static int read_quality(const FieldView& field, bool& error) {
+            const char* curr = field.begin;
+            int value = 0;
+            if (!read_int(curr, field.end, value)) {
+                error = true;
+            }
+            return value;
+        }
+
+        // Finds the first (at most max) non-empty fields of a sample column
+        // and returns their number.
+        static long locate(const string& genotype, FieldView* fields, long max) {
+            long n = 0;
+            const char* curr = genotype.data();
+            const char* end = curr + genotype.size();
+            while (n < max && curr != end) {
+                const char* stop = static_cast<const char*>(std::memchr(curr, DELIM, end - curr));
+                if (stop == nullptr) {
+                    stop = end;
                 }
-                int dp = depth_pos == -1 ? 0 : stoi(parts[depth_pos]);
-                int gq = qual_pos == -1 ? 0 : stoi(parts[qual_pos]);
-                if (!filter.apply(dp, gq)) {
-                    return {MISSING, (unsigned)dp, (unsigned)gq};
+                if (stop != curr) {
+                    fields[n++] = {curr, stop};
                 }
-                return {parse_gt(gt, allele), (unsigned)dp, (unsigned)gq};
-            } catch (...) {
-                throw ParserException("Wrong GT format");
+                curr = stop == end ? end : stop + 1;
+            }
+            return n;
+        }
+
+        // Decoder for a layout known at compile time: GT, AD, DP and GQ are
+        // field indices, -1 for absent fields. Only the fields up to the last
+        // used one are located and fields after it (PL etc.) are not read.
+        // Trailing fields may be dropped from a sample, as in "0/0" under
+        // GT:AD:DP:GQ: a dropped AD is not checked and a dropped DP or GQ is
+        // 0. Malformed samples set error, which makes the whole line invalid.
+        template <long GT_POS, long AD_POS, long DP_POS, long GQ_POS>
+        static Allele decode(const string& genotype, int allele, const VCFFilter& filter, bool& error) {
+            const long N = max_of(max_of(GT_POS, AD_POS), max_of(DP_POS, GQ_POS)) + 1;
+            FieldView fields[N] = {};
+            long n = locate(genotype, fields, N);
+            if (n <= GT_POS) {
+                error = true;
+                return {MISSING, 0, 0};
+            }
+            const FieldView& gt = fields[GT_POS];
+            if (is_missing(gt)) {
+                return {MISSING, 0, 0};
+            }
+            if (AD_POS != -1 && n > AD_POS && unbalanced(fields[AD_POS])) {
+                return {MISSING, 0, 0};
+            }
+            int dp = 0;
+            if (DP_POS != -1 && n > DP_POS) {
+                dp = read_quality(fields[DP_POS], error);
+            }
+            int gq = 0;
+            if (GQ_POS != -1 && n > GQ_POS) {
+                gq = read_quality(fields[GQ_POS], error);
+            }
+            if (!filter.apply(dp, gq)) {
+                return {MISSING, (unsigned)dp, (unsigned)gq};
+            }
+            return {decode_gt(gt, allele, error), (unsigned)dp, (unsigned)gq};
+        }
+
+        template <long GT_POS, long AD_POS, long DP_POS, long GQ_POS>
+        static bool decode_all(const Columns& genotypes, int allele, const VCFFilter& filter,
+                               vector<Allele>& alleles) {
+            bool error = false;
+            for (const string& genotype : genotypes) {
+                alleles.push_back(decode<GT_POS, AD_POS, DP_POS, GQ_POS>(genotype, allele, filter, error));
+            }
+            return !error;
+        }
+
+        // Same as decode for any layout.
+        Allele parse(const string& genotype, int allele, const VCFFilter& filter, bool& error) {
+            long n = locate(genotype, fields.data(), fields.size());
+            if (genotype_pos >= n) {
+                error = true;
+                return {MISSING, 0, 0};
+            }
+            const FieldView& gt = fields[genotype_pos];
+            if (is_missing(gt)) {
+                return {MISSING, 0, 0};
+            }
+            if (ad_pos != -1 && ad_pos < n && unbalanced(fields[ad_pos])) {
+                return {MISSING, 0, 0};
+            }
+            int dp = depth_pos == -1 || depth_pos >= n ? 0 : read_quality(fields[depth_pos], error);
+            int gq = qual_pos == -1 || qual_pos >= n ? 0 : read_quality(fields[qual_pos], error);
+            if (!filter.apply(dp, gq)) {
+                return {MISSING, (unsigned)dp, (unsigned)gq};
+            }
+            return {decode_gt(gt, allele, error), (unsigned)dp, (unsigned)gq};
+        }
+
+    public:
+        Format(const string& format) {
+            vector<string> parts = split(format, DELIM);
+            fields.resize(parts.size());
+            find_pos(parts, DP_FIELD, depth_pos);
+            find_pos(parts, GQ_FIELD, qual_pos);
+            find_pos(parts, AD_FIELD, ad_pos);
+            find_pos(parts, GT_FIELD, genotype_pos);
+            if (has_layout(0, 1, 2, 3)) {
+                layout = GT_AD_DP_GQ;
+            } else if (has_layout(0, -1, 1, 2)) {
+                layout = GT_DP_GQ;
+            } else if (has_layout(0, -1, 1, -1)) {
+                layout = GT_DP;
+            } else if (has_layout(0, -1, -1, -1)) {
+                layout = GT;
+            } else {
+                layout = GENERIC;
+            }
+        }
+
+        bool has_gt() const {
+            return genotype_pos != -1;
+        }
+
+        // Appends the calls of all samples for the given alternative allele
+        // and returns false if any sample is malformed. The layout is resolved
+        // once per line, so the per-sample loop runs inside a decoder
+        // specialized for it.
+        bool parse(const Columns& genotypes, int allele, const VCFFilter& filter,
+                   vector<Allele>& alleles) {
+            switch (layout) {
+                case GT_AD_DP_GQ:
+                    return decode_all<0, 1, 2, 3>(genotypes, allele, filter, alleles);
+                case GT_DP_GQ:
+                    return decode_all<0, -1, 1, 2>(genotypes, allele, filter, alleles);
+                case GT_DP:
+                    return decode_all<0, -1, 1, -1>(genotypes, allele, filter, alleles);
+                case GT:
+                    return decode_all<0, -1, -1, -1>(genotypes, allele, filter, alleles);
+                default:
+                    bool error = false;
+                    for (const string& genotype : genotypes) {
+                        alleles.push_back(parse(genotype, allele, filter, error));
+                    }
+                    return !error;
             }
         }
     };
@@ -160,24 +445,56 @@ namespace {
 
 namespace vcf {
 
+    // Per-line storage kept by the parser. Once it fits the longest line,
+    // the widest set of columns and the most alternative alleles seen,
+    // parsing a line allocates nothing here. Variants passed to handlers
+    // still copy REF and ALT, which allocates for alleles longer than the
+    // small string buffer. tests/cpp/vcf_allocations.cpp checks this.
+    struct VCFParser::LineBuffers {
+        string line;
+        Columns tokens;
+        Columns genotypes;
+        Columns alts;
+        vector<Variant> variants;
+        vector<Allele> alleles;
+        string format_field;
+        std::unique_ptr<Format> format;
+        Chromosome chromosome = Chromosome("1");
+
+        // Returns the decoder for a FORMAT column. Only the last one is kept,
+        // it is rebuilt when the column differs from the previous line.
+        Format& parse_format(const string& field) {
+            if (!format || field != format_field) {
+                format_field = field;
+                format.reset(new Format(field));
+            }
+            return *format;
+        }
+    };
+
     void VCFParser::register_handler(std::shared_ptr<VariantsHandler> handler) {
         handlers.push_back(handler);
     }
 
-    VCFParser::VCFParser(std::istream& input, const VCFFilter& filter) :input(input), filter(filter), line_num(0) {}
+    VCFParser::VCFParser(std::istream& input, const VCFFilter& filter)
+            :VCFParser(input, std::make_shared<const VCFFilter>(filter)) {}
+
+    VCFParser::VCFParser(std::istream& input, std::shared_ptr<const VCFFilter> filter)
+            :filter(filter), input(input), line_num(0), buffers(new LineBuffers()) {}
+
+    VCFParser::~VCFParser() = default;
 
     std::vector<std::string> VCFParser::sample_names() {
         return samples;
     }
 
-    vector<Variant> VCFParser::parse_variants(const vector<string>& tokens, const Position& position) {
-        vector<Variant> variants;
-        string ref = tokens[REF];
-        vector<string> alts = split(tokens[ALT], ',');
-        for (const string& alt: alts) {
-            variants.emplace_back(position, ref, alt);
+    void VCFParser::parse_variants(const Position& position) {
+        LineBuffers& b = *buffers;
+        split(b.tokens[ALT], ',', b.alts);
+        b.variants.clear();
+        for (const string& alt: b.alts) {
+            b.variants.emplace_back(position, b.tokens[REF], alt);
         }
-        return variants;
     }
 
     void VCFParser::parse_header() {
@@ -198,7 +515,7 @@ namespace vcf {
                                                   "Found: " + token, line_num);
                         }
                     } else {
-                        if (filter.apply(token)) {
+                        if (filter->apply(token)) {
                             samples.push_back(token);
                             filtered_samples.push_back(i);
                         }
@@ -210,40 +527,69 @@ namespace vcf {
     }
 
     void VCFParser::parse_genotypes() {
-        string line;
-        while (getline(input, line)) {
-            ++line_num;
-            vector<string> tokens = split(line, DELIM);
-            if (tokens[FILTER] != "PASS") {
-                continue;
-            }
-            try {
-                Position position = parse_position(tokens);
-                if (!filter.apply(position)) {
-                    continue;
+        while (parse_line()) {}
+    }
+
+    bool VCFParser::parse_line() {
+        return parse_line(*buffers);
+    }
+
+    bool VCFParser::parse_line(LineBuffers& b) {
+        if (!getline(input, b.line)) {
+            return false;
+        }
+        ++line_num;
+        split_columns(b.line, DELIM, filtered_samples, b.tokens, b.genotypes);
+        // Lines not passing FILTER are skipped before their format is checked.
+        if (b.tokens.size() > FILTER && b.tokens[FILTER] != "PASS") {
+            return true;
+        }
+        if (b.tokens.size() < FIELDS.size() || b.genotypes.size() < filtered_samples.size()) {
+            errors.add(WRONG_LINE_FORMAT, line_num);
+            return true;
+        }
+        const string& chr = b.tokens[CHROM];
+        if (!Chromosome::try_parse(chr, b.chromosome)) {
+            errors.add(UNKNOWN_CHROMOSOME, line_num, chr);
+            return true;
+        }
+        const char* pos = b.tokens[POS].c_str();
+        int position_num;
+        if (!read_int(pos, pos + b.tokens[POS].size(), position_num)) {
+            errors.add(WRONG_POSITION, line_num);
+            return true;
+        }
+        Position position(b.chromosome, position_num);
+        if (!filter->apply(position)) {
+            return true;
+        }
+        parse_variants(position);
+        Format& format = b.parse_format(b.tokens[FORMAT]);
+        if (!format.has_gt()) {
+            errors.add(NO_GT_FIELD, line_num);
+            return true;
+        }
+        for (int i = 0; i < b.variants.size(); i++) {
+            const Variant& variant = b.variants[i];
+            if (filter->apply(variant)) {
+                b.alleles.clear();
+                if (!format.parse(b.genotypes, i + 1, *filter, b.alleles)) {
+                    errors.add(WRONG_GT_FORMAT, line_num);
+                    return true;
                 }
-                vector<Variant> variants = parse_variants(tokens, position);
-                Format format(tokens[FORMAT]);
-                for (int i = 0; i < variants.size(); i++) {
-                    Variant& variant = variants[i];
-                    if (filter.apply(variant)) {
-                        vector<Allele> alleles;
-                        for (int sample : filtered_samples) {
-                            alleles.push_back(format.parse(tokens[sample], i + 1, filter));
-                        }
-                        for (auto& handler: handlers) {
-                            handler->processVariant(variant, alleles);
-                        }
-                    }
+                for (auto& handler: handlers) {
+                    handler->processVariant(variant, b.alleles);
                 }
-            } catch (const ParserException& e) {
-                ParserException exception(e.get_message(), line_num);
-                handle_error(exception);
             }
         }
+        return true;
+    }
+
+    int VCFParser::line_number() const {
+        return line_num;
     }
 
-    void VCFParser::handle_error(const ParserException& e) {
-        std::cerr << e.get_message() << std::endl;
+    ParserDiagnostics& VCFParser::diagnostics() {
+        return errors;
     }
 }
@@ -5,6 +5,8 @@
 #include "vcf_filter.h"
 #include "vcf_handlers.h"
 
+#include <memory>
+
 namespace vcf {
     enum Field {
         CHROM, POS, ID, REF, ALT, QUAL, FILTER, INFO, FORMAT
@@ -14,7 +16,7 @@ namespace vcf {
         static const char DELIM = '\t';
         const std::vector<std::string> FIELDS = {"CHROM", "POS", "ID", "REF", "ALT", "QUAL", "FILTER", "INFO", "FORMAT"};
 
-        VCFFilter filter;
+        std::shared_ptr<const VCFFilter> filter;
 
         std::vector<std::shared_ptr<VariantsHandler>> handlers;
         std::istream& input;
@@ -22,17 +24,29 @@ namespace vcf {
         std::vector<int> filtered_samples;
 
         int line_num;
+        ParserDiagnostics errors;
+
+        // Storage for the pieces of a line, reused from line to line.
+        struct LineBuffers;
+        std::unique_ptr<LineBuffers> buffers;
 
-        std::vector<Variant> parse_variants(const std::vector<std::string>& tokens, const Position& position);
-        virtual void handle_error(const ParserException& e);
+        void parse_variants(const Position& position);
+        bool parse_line(LineBuffers& buffers);
 
     public:
         VCFParser(std::istream& input, const VCFFilter& filter);
+        // Parsers reading shards of one file set share a single filter.
+        VCFParser(std::istream& input, std::shared_ptr<const VCFFilter> filter);
+        virtual ~VCFParser();
         void parse_header();
         void parse_genotypes();
+        bool parse_line();
         void register_handler(std::shared_ptr<VariantsHandler> handler);
 
         std::vector<std::string> sample_names();
+        int line_number() const;
+        // Lines skipped because of errors, counted by error.
+        ParserDiagnostics& diagnostics();
 };
 
 }
@@ -0,0 +1,101 @@
+#ifndef SRC_VCF_PIPELINE_H
+#define SRC_VCF_PIPELINE_H
+
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <string>
+
+#include "vcf_handlers.h"
+
+namespace vcf {
+    namespace pipeline {
+        // Calls the stage hooks of tuple elements I..N-1 in order.
+        template <std::size_t I, std::size_t N>
+        struct Stages {
+            template <typename Tuple>
+            static void begin(Tuple& stages, const Variant& variant) {
+                std::get<I>(stages)->begin(variant);
+                Stages<I + 1, N>::begin(stages, variant);
+            }
+
+            template <typename Tuple>
+            static void add(Tuple& stages, int sample, const Allele& allele) {
+                std::get<I>(stages)->add(sample, allele);
+                Stages<I + 1, N>::add(stages, sample, allele);
+            }
+
+            template <typename Tuple>
+            static void end(Tuple& stages, const Variant& variant) {
+                std::get<I>(stages)->end(variant);
+                Stages<I + 1, N>::end(stages, variant);
+            }
+        };
+
+        template <std::size_t N>
+        struct Stages<N, N> {
+            template <typename Tuple>
+            static void begin(Tuple& stages, const Variant& variant) {}
+
+            template <typename Tuple>
+            static void add(Tuple& stages, int sample, const Allele& allele) {}
+
+            template <typename Tuple>
+            static void end(Tuple& stages, const Variant& variant) {}
+        };
+    }
+
+    // Handler set fixed at compile time. Each variant costs one virtual call
+    // for the whole set, and the hooks of all handlers run in a single pass
+    // over the samples.
+    template <typename... Handlers>
+    class Pipeline: public VariantsHandler {
+        typedef std::tuple<std::shared_ptr<Handlers>...> Tuple;
+        typedef pipeline::Stages<0, sizeof...(Handlers)> All;
+
+        Tuple stages;
+    public:
+        Pipeline(const std::vector<std::string>& samples, const Tuple& stages)
+                :VariantsHandler(samples), stages(stages) {}
+
+        void processVariant(const Variant& variant, const std::vector<Allele>& alleles) override {
+            All::begin(stages, variant);
+            int n = (int)alleles.size();
+            for (int i = 0; i < n; i++) {
+                All::add(stages, i, alleles[i]);
+            }
+            All::end(stages, variant);
+        }
+    };
+
+    template <typename... Chosen>
+    std::shared_ptr<VariantsHandler> compose(const std::vector<std::string>& samples,
+                                             const std::tuple<std::shared_ptr<Chosen>...>& chosen) {
+        return std::make_shared<Pipeline<Chosen...>>(samples, chosen);
+    }
+
+    // Handlers in `chosen` are always part of the Pipeline, every optional
+    // handler that follows is added if it is not null. Each combination of
+    // present optional handlers is a separate instantiation, so callers pass
+    // as fixed the handlers they know are there and keep mutually exclusive
+    // handlers in separate calls.
+    template <typename... Chosen, typename Next, typename... Rest>
+    std::shared_ptr<VariantsHandler> compose(const std::vector<std::string>& samples,
+                                             const std::tuple<std::shared_ptr<Chosen>...>& chosen,
+                                             const std::shared_ptr<Next>& next,
+                                             const std::shared_ptr<Rest>&... rest) {
+        if (next) {
+            return compose(samples, std::tuple_cat(chosen, std::make_tuple(next)), rest...);
+        }
+        return compose(samples, chosen, rest...);
+    }
+
+    // Combines the non-null handlers into one Pipeline.
+    template <typename... Handlers>
+    std::shared_ptr<VariantsHandler> compose(const std::vector<std::string>& samples,
+                                             const std::shared_ptr<Handlers>&... handlers) {
+        return compose(samples, std::tuple<>(), handlers...);
+    }
+}
+
+#endif //SRC_VCF_PIPELINE_H
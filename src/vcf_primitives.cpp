@@ -2,12 +2,12 @@
 
 #include <string>
 #include <algorithm>
+#include <cstdlib>
 
 namespace {
     using std::string;
     using std::to_string;
     using std::transform;
-    using std::invalid_argument;
     using std::vector;
 }
 
@@ -109,14 +109,24 @@ namespace vcf {
             return true;
         }
 
-        try {
-            chr = stoi(str);
-            if (chr < 1 || chr > 22) {
-                return false;
-            }
-        } catch (invalid_argument& e) {
+        // strtol reads the number the way stoi does but reports contigs such
+        // as "m" or "un" without throwing.
+        const char* begin = str.c_str();
+        char* end;
+        long num = std::strtol(begin, &end, 10);
+        if (end == begin || num < 1 || num > 22) {
+            return false;
+        }
+        chr = (int)num;
+        return true;
+    }
+
+    bool Chromosome::try_parse(const std::string& str, Chromosome& chr) {
+        Chromosome parsed(chr);
+        if (!parsed.parse(str)) {
             return false;
         }
+        chr = parsed;
         return true;
     }
 
@@ -156,6 +166,81 @@ namespace vcf {
         msg = "Error in line " + to_string(line) + ": " + message;
     }
 
+    ParserDiagnostics::ParserDiagnostics(unsigned long max_messages) :counts(), max_messages(max_messages) {}
+
+    void ParserDiagnostics::add(ParserError error, int line, const std::string& detail) {
+        ++counts[error];
+        if (messages.size() < max_messages) {
+            messages.push_back(ParserException(description(error) + detail, line).get_message());
+        }
+    }
+
+    void ParserDiagnostics::merge(const ParserDiagnostics& other) {
+        for (int i = 0; i < N_ERRORS; i++) {
+            counts[i] += other.counts[i];
+        }
+        for (const string& message: other.messages) {
+            if (messages.size() < max_messages) {
+                messages.push_back(message);
+            }
+        }
+    }
+
+    void ParserDiagnostics::clear() {
+        counts.fill(0);
+        messages.clear();
+    }
+
+    unsigned long ParserDiagnostics::count(ParserError error) const {
+        return counts[error];
+    }
+
+    unsigned long ParserDiagnostics::total() const {
+        unsigned long sum = 0;
+        for (unsigned long count: counts) {
+            sum += count;
+        }
+        return sum;
+    }
+
+    const std::vector<std::string>& ParserDiagnostics::sample() const {
+        return messages;
+    }
+
+    std::vector<ParserError> ParserDiagnostics::errors() {
+        return {WRONG_LINE_FORMAT, UNKNOWN_CHROMOSOME, WRONG_POSITION, NO_GT_FIELD, WRONG_GT_FORMAT};
+    }
+
+    std::string ParserDiagnostics::name(ParserError error) {
+        switch (error) {
+            case WRONG_LINE_FORMAT:
+                return "line_format";
+            case UNKNOWN_CHROMOSOME:
+                return "chromosome";
+            case WRONG_POSITION:
+                return "position";
+            case NO_GT_FIELD:
+                return "no_gt";
+            default:
+                return "gt_format";
+        }
+    }
+
+    std::string ParserDiagnostics::description(ParserError error) {
+        switch (error) {
+            case WRONG_LINE_FORMAT:
+                return "Wrong line format: too few columns";
+            case UNKNOWN_CHROMOSOME:
+                return R"(Parser error: expected "chr##", found )";
+            case WRONG_POSITION:
+                return "Can't read variant position";
+            case NO_GT_FIELD:
+                return "No GT field available for a variant";
+            default:
+                return "Wrong GT format";
+        }
+    }
+
     Range::Range(Chromosome chr, int from, int to)
         :chr(chr), from(from), to(to) {}
 
@@ -185,20 +270,6 @@ namespace vcf {
         return {chromosome, startpos, endpos};
     }
 
-    Allele::Allele(AlleleType type, unsigned DP, unsigned GQ) :type(type), depth(DP), quality(GQ){}
-
-    unsigned Allele::DP() const {
-        return depth;
-    }
-
-    unsigned Allele::GQ() const {
-        return quality;
-    }
-
-    AlleleType Allele::alleleType() const {
-        return type;
-    }
-
     std::ostream& operator<<(std::ostream& out, const AlleleBinary& allele) {
         out.write(reinterpret_cast<const char*>(&allele), sizeof(AlleleBinary));
         return out;
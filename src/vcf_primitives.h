@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <array>
 #include <istream>
 #include <unordered_map>
 #include <unordered_set>
@@ -25,6 +26,37 @@ namespace vcf {
         std::string get_message() const;
     };
 
+    // Recoverable errors that make a parser skip a line.
+    enum ParserError {
+        WRONG_LINE_FORMAT, UNKNOWN_CHROMOSOME, WRONG_POSITION, NO_GT_FIELD, WRONG_GT_FORMAT
+    };
+
+    // Counts skipped lines by error and keeps the messages of only the first
+    // few, so that files with many bad lines (i.e. chrM or decoy contigs)
+    // cost a counter increment per line.
+    class ParserDiagnostics {
+        static const int N_ERRORS = WRONG_GT_FORMAT + 1;
+
+        std::array<unsigned long, N_ERRORS> counts;
+        std::vector<std::string> messages;
+        unsigned long max_messages;
+    public:
+        explicit ParserDiagnostics(unsigned long max_messages = 10);
+
+        // detail is appended to the message of errors that are kept.
+        void add(ParserError error, int line, const std::string& detail = std::string());
+        void merge(const ParserDiagnostics& other);
+        void clear();
+
+        unsigned long count(ParserError error) const;
+        unsigned long total() const;
+        const std::vector<std::string>& sample() const;
+
+        static std::vector<ParserError> errors();
+        static std::string name(ParserError error);
+        static std::string description(ParserError error);
+    };
+
     class Chromosome {
         static const int chrX = 23;
         static const int chrY = 24;
@@ -35,6 +67,9 @@ namespace vcf {
 
     public:
         explicit Chromosome(const std::string&);
+        // Non-throwing counterpart of the constructor: returns false and
+        // leaves chr unchanged if str is not an autosome, X or Y.
+        static bool try_parse(const std::string& str, Chromosome& chr);
         explicit operator std::string() const;
         int num() const;
 
@@ -92,11 +127,21 @@ namespace vcf {
         unsigned quality;
         AlleleType type;
     public:
-        Allele(AlleleType type, unsigned DP, unsigned GQ);
+        // Defined here so that the per-sample loops of parsers and handlers
+        // inline them.
+        Allele(AlleleType type, unsigned DP, unsigned GQ) :depth(DP), quality(GQ), type(type) {}
+
+        unsigned DP() const {
+            return depth;
+        }
 
-        unsigned DP() const;
-        unsigned GQ() const;
-        AlleleType alleleType() const;
+        unsigned GQ() const {
+            return quality;
+        }
+
+        AlleleType alleleType() const {
+            return type;
+        }
     };
 
     struct AlleleBinary {
@@ -1,8 +1,14 @@
 #include "vcf_parser.h"
+#include "plink_parser.h"
+#include "thread_pool.h"
+#include "r_handlers.h"
+#include "vcf_pipeline.h"
 #include <Rcpp.h>
 #include <boost/algorithm/string/predicate.hpp>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <limits>
 #include "zstr/zstr.hpp"
 #include "zstr/strict_fstream.hpp"
 
@@ -12,52 +18,152 @@ namespace {
     using namespace std;
     using boost::algorithm::ends_with;
 
-    class Parser: public VCFParser {
-        void handle_error(const vcf::ParserException& e) override {
-            Rf_warning(e.get_message().c_str());
+    // Reports the lines skipped by VCF and PLINK parsers in a single warning
+    // with the counts by error and the first message.
+    void warn(const ParserDiagnostics& diagnostics) {
+        if (diagnostics.total() == 0) {
+            return;
         }
+        string counts;
+        for (ParserError error: ParserDiagnostics::errors()) {
+            if (diagnostics.count(error) > 0) {
+                counts += (counts.empty() ? "" : ", ") + ParserDiagnostics::name(error) + ": " +
+                          to_string(diagnostics.count(error));
+            }
+        }
+        string message = "Skipped " + to_string(diagnostics.total()) + " lines with errors (" + counts + ")";
+        if (!diagnostics.sample().empty()) {
+            message += ", first: " + diagnostics.sample()[0];
+        }
+        Rf_warning("%s", message.c_str());
+    }
+
+    List summary(const ParserDiagnostics& diagnostics) {
+        vector<ParserError> errors = ParserDiagnostics::errors();
+        IntegerVector counts(errors.size());
+        CharacterVector names(errors.size());
+        for (int i = 0; i < errors.size(); i++) {
+            counts[i] = (int)diagnostics.count(errors[i]);
+            names[i] = ParserDiagnostics::name(errors[i]);
+        }
+        counts.attr("names") = names;
+        const vector<string>& messages = diagnostics.sample();
+        return List::create(Named("counts") = counts,
+                            Named("messages") = CharacterVector(messages.begin(), messages.end()));
+    }
+
+    class ChromosomeOrderHandler: public VariantsHandler {
+        int first;
     public:
-        using VCFParser::VCFParser;
+        explicit ChromosomeOrderHandler(const vector<string>& samples)
+            :VariantsHandler(samples), first(std::numeric_limits<int>::max()) {}
+
+        void processVariant(const Variant& variant, const vector<Allele>& alleles) override {
+            process(*this, variant, alleles);
+        }
+
+        void begin(const Variant& variant) {
+            first = std::min(first, variant.position().chromosome().num());
+        }
+
+        int chromosome() const {
+            return first;
+        }
     };
 
-    class RGenotypeMatrixHandler: public GenotypeMatrixHandler {
-    public:
-        using GenotypeMatrixHandler::GenotypeMatrixHandler;
-
-        IntegerMatrix result() {
-            IntegerMatrix res(gmatrix.size(), samples.size());
-            for (int i = 0; i < gmatrix.size(); i++) {
-                for (int j = 0; j < samples.size(); j++) {
-                    int val = gmatrix[i][j];
-                    if (val == vcf::MISSING) {
-                        val = NA_INTEGER;
-                    }
-                    res[j * gmatrix.size() + i] = val;
-                }
+    struct Shard {
+        string filename;
+        unique_ptr<std::istream> in;
+        unique_ptr<VCFParser> parser;
+
+        shared_ptr<RGenotypeMatrixHandler> gmatrix_handler;
+        shared_ptr<RSparseGenotypeMatrixHandler> sparse_handler;
+        shared_ptr<BinaryFileHandler> binary_handler;
+        shared_ptr<RCallRateHandler> callrate_handler;
+        shared_ptr<RGenotypeCountsHandler> counts_handler;
+        shared_ptr<ChromosomeOrderHandler> order_handler;
+        string binary_file;
+        string meta_file;
+
+        Shard(const string& filename, const shared_ptr<const VCFFilter>& filter)
+                :filename(filename), in(new zstr::ifstream(filename)), parser(new VCFParser(*in, filter)) {
+            parser->parse_header();
+        }
+
+        // Every handler set runs as one Pipeline. The genotype matrix, dense
+        // or sparse, is fixed by the branch, so the Pipelines instantiated
+        // are the sets parse_vcf can build: no, a dense or a sparse matrix
+        // with any of call rates, counts, binary output and chromosome order.
+        void register_handlers() {
+            vector<string> ss = parser->sample_names();
+            if (gmatrix_handler) {
+                parser->register_handler(compose(ss, std::make_tuple(gmatrix_handler), callrate_handler,
+                                                 counts_handler, binary_handler, order_handler));
+            } else if (sparse_handler) {
+                parser->register_handler(compose(ss, std::make_tuple(sparse_handler), callrate_handler,
+                                                 counts_handler, binary_handler, order_handler));
+            } else {
+                parser->register_handler(compose(ss, callrate_handler, counts_handler, binary_handler,
+                                                 order_handler));
+            }
+        }
+
+        // Closes and deletes the binary output written so far.
+        void discard() {
+            if (binary_handler) {
+                binary_handler.reset();
+                std::remove(binary_file.c_str());
+                std::remove(meta_file.c_str());
             }
-            vector<string> row_names;
-            for_each(variants.begin(), variants.end(), [&row_names](Variant& v){
-                row_names.push_back((string)v);
-            });
-            rownames(res) = CharacterVector(row_names.begin(), row_names.end());
-            return res;
         }
     };
 
-    class RCallRateHandler: public CallRateHandler {
+    class VCFStream {
+        unique_ptr<std::istream> in;
+        VCFParser parser;
+        shared_ptr<RGenotypeMatrixHandler> handler;
     public:
-        using CallRateHandler::CallRateHandler;
+        VCFStream(const string& filename, const VCFFilter& filter)
+                :in(new zstr::ifstream(filename)), parser(*in, filter) {
+            parser.parse_header();
+            handler.reset(new RGenotypeMatrixHandler(parser.sample_names()));
+            parser.register_handler(handler);
+        }
+
+        vector<string> samples() {
+            return parser.sample_names();
+        }
+
+        // Reads lines until the chunk is full. Variants of a multiallelic line
+        // that do not fit are kept for the next chunk.
+        IntegerMatrix next(unsigned long size) {
+            while (handler->size() < size && parser.parse_line()) {}
+            warn(parser.diagnostics());
+            parser.diagnostics().clear();
+            return handler->result(size);
+        }
+
+        int line_number() const {
+            return parser.line_number();
+        }
+    };
 
-        NumericMatrix result() {
-            NumericMatrix result(ranges.size(), samples.size());
-            for (int i = 0; i < ranges.size(); i++) {
-                for (int j = 0; j < samples.size(); j++) {
-                    result[j * ranges.size() + i] = (double)call_rate_matrix[i][j] / n_variants[i];
+    void concatenate(const vector<string>& parts, const string& target, bool skip_header) {
+        std::ofstream out(target, std::ios::binary);
+        for (int i = 0; i < parts.size(); i++) {
+            {
+                std::ifstream in(parts[i], std::ios::binary);
+                if (skip_header && i > 0) {
+                    string header;
+                    getline(in, header);
+                }
+                if (in.peek() != std::ifstream::traits_type::eof()) {
+                    out << in.rdbuf();
                 }
             }
-            return result;
+            std::remove(parts[i].c_str());
         }
-    };
+    }
 }
 
 VCFFilter filter(const CharacterVector& samples, const CharacterVector& bad_positions,
@@ -101,43 +207,233 @@ vector<vcf::Range> parse_regions(const CharacterVector& regions){
 List parse_vcf(const CharacterVector& filename, const CharacterVector& samples,
                const CharacterVector& bad_positions, const CharacterVector& allowed_variants,
                const IntegerVector& DP, const IntegerVector& GQ, const CharacterVector& regions,
-               const LogicalVector& ret_gmatrix, const CharacterVector& binary_prefix) {
+               const LogicalVector& ret_gmatrix, const LogicalVector& sparse,
+               const CharacterVector& binary_prefix, const LogicalVector& ret_counts,
+               const IntegerVector& threads) {
     List ret;
     try {
-        const char *name = filename[0];
-        unique_ptr<std::istream> in(new zstr::ifstream(name));
+        auto vcf_filter = std::make_shared<const VCFFilter>(filter(samples, bad_positions, allowed_variants,
+                                                                   DP[0], GQ[0]));
+        vector<unique_ptr<Shard>> shards;
+        for (int i = 0; i < filename.length(); i++) {
+            shards.emplace_back(new Shard(string(filename[i]), vcf_filter));
+        }
+        auto ss = shards[0]->parser->sample_names();
+        for (auto& shard: shards) {
+            if (shard->parser->sample_names() != ss) {
+                throw ParserException("Samples in " + shard->filename + " differ from samples in " +
+                                      shards[0]->filename);
+            }
+        }
 
-        Parser parser(*in, filter(samples, bad_positions, allowed_variants, DP[0], GQ[0]));
+        vector<vcf::Range> ranges = parse_regions(regions);
+        bool multiple = shards.size() > 1;
+        for (int i = 0; i < shards.size(); i++) {
+            Shard& shard = *shards[i];
+            if (ret_gmatrix[0] && sparse[0]) {
+                shard.sparse_handler.reset(new RSparseGenotypeMatrixHandler(ss));
+            } else if (ret_gmatrix[0]) {
+                shard.gmatrix_handler.reset(new RGenotypeMatrixHandler(ss));
+            }
+
+            if (regions.length() > 0) {
+                shard.callrate_handler.reset(new RCallRateHandler(ss, ranges));
+            }
+
+            if (ret_counts[0]) {
+                shard.counts_handler.reset(new RGenotypeCountsHandler(ss));
+            }
+
+            if (binary_prefix.length() > 0) {
+                string prefix = string(binary_prefix[0]);
+                string suffix = multiple ? "." + to_string(i) : "";
+                shard.binary_file = prefix + "_bin" + suffix;
+                shard.meta_file = prefix + "_meta" + suffix;
+                shard.binary_handler.reset(new BinaryFileHandler(ss, shard.binary_file, shard.meta_file));
+            }
+
+            if (multiple) {
+                shard.order_handler.reset(new ChromosomeOrderHandler(ss));
+            }
+            shard.register_handlers();
+        }
+
+        int n_threads = std::min(thread_pool::resolve_threads(threads[0]), (int)shards.size());
+        try {
+            thread_pool pool(n_threads);
+            pool.run((int)shards.size(), [&shards](int i) {
+                shards[i]->parser->parse_genotypes();
+            });
+        } catch (...) {
+            for (auto& shard: shards) {
+                shard->parser.reset();
+                shard->discard();
+            }
+            throw;
+        }
+        ParserDiagnostics diagnostics;
+        for (auto& shard: shards) {
+            diagnostics.merge(shard->parser->diagnostics());
+            shard->parser.reset();
+            shard->in.reset();
+        }
+
+        if (multiple) {
+            std::stable_sort(shards.begin(), shards.end(),
+                    [](const unique_ptr<Shard>& a, const unique_ptr<Shard>& b) {
+                return a->order_handler->chromosome() < b->order_handler->chromosome();
+            });
+        }
+        Shard& first = *shards[0];
+        for (int i = 1; i < shards.size(); i++) {
+            if (ret_gmatrix[0] && sparse[0]) {
+                first.sparse_handler->append(*shards[i]->sparse_handler);
+            } else if (ret_gmatrix[0]) {
+                first.gmatrix_handler->append(*shards[i]->gmatrix_handler);
+            }
+            if (regions.length() > 0) {
+                first.callrate_handler->merge(*shards[i]->callrate_handler);
+            }
+            if (ret_counts[0]) {
+                first.counts_handler->append(*shards[i]->counts_handler);
+            }
+        }
+        if (binary_prefix.length() > 0 && multiple) {
+            vector<string> binaries;
+            vector<string> metas;
+            for (auto& shard: shards) {
+                shard->binary_handler.reset();
+                binaries.push_back(shard->binary_file);
+                metas.push_back(shard->meta_file);
+            }
+            string prefix = string(binary_prefix[0]);
+            concatenate(binaries, prefix + "_bin", false);
+            concatenate(metas, prefix + "_meta", true);
+        }
+
+        warn(diagnostics);
+        ret["samples"] = CharacterVector(ss.begin(), ss.end());
+        ret["errors"] = summary(diagnostics);
+        if (ret_gmatrix[0] && sparse[0]) {
+            ret["genotype"] = first.sparse_handler->result();
+        } else if (ret_gmatrix[0]) {
+            ret["genotype"] = first.gmatrix_handler->result();
+        }
+        if (regions.length() > 0) {
+            ret["callrate"] = first.callrate_handler->result();
+        }
+        if (ret_counts[0]) {
+            ret["counts"] = first.counts_handler->result();
+        }
+    } catch (ParserException& e) {
+        ::Rf_error(e.get_message().c_str());
+    }
+    return ret;
+}
+
+// [[Rcpp::export]]
+List open_vcf_stream(const CharacterVector& filename, const CharacterVector& samples,
+                     const CharacterVector& bad_positions, const CharacterVector& allowed_variants,
+                     const IntegerVector& DP, const IntegerVector& GQ) {
+    List ret;
+    try {
+        XPtr<VCFStream> stream(new VCFStream(string(filename[0]),
+                filter(samples, bad_positions, allowed_variants, DP[0], GQ[0])), true);
+        auto ss = stream->samples();
+        ret["stream"] = stream;
+        ret["samples"] = CharacterVector(ss.begin(), ss.end());
+    } catch (ParserException& e) {
+        ::Rf_error(e.get_message().c_str());
+    }
+    return ret;
+}
+
+// [[Rcpp::export]]
+List read_vcf_chunk(SEXP stream, const IntegerVector& size) {
+    XPtr<VCFStream> vcf_stream(stream);
+    List ret;
+    ret["genotype"] = vcf_stream->next((unsigned long)size[0]);
+    ret["line"] = IntegerVector(1, vcf_stream->line_number());
+    return ret;
+}
+
+// [[Rcpp::export]]
+List parse_plink(const CharacterVector& bfile, const CharacterVector& samples,
+                 const CharacterVector& bad_positions, const CharacterVector& allowed_variants,
+                 const LogicalVector& ret_gmatrix, const CharacterVector& binary_prefix,
+                 const LogicalVector& ret_counts) {
+    List ret;
+    try {
+        PlinkParser parser(string(bfile[0]), filter(samples, bad_positions, allowed_variants, 0, 0));
         parser.parse_header();
         auto ss = parser.sample_names();
         shared_ptr<RGenotypeMatrixHandler> gmatrix_handler;
         shared_ptr<BinaryFileHandler> binary_handler;
-        shared_ptr<RCallRateHandler> callrate_handler;
+        shared_ptr<RGenotypeCountsHandler> counts_handler;
 
         if (ret_gmatrix[0]) {
             gmatrix_handler.reset(new RGenotypeMatrixHandler(ss));
-            parser.register_handler(gmatrix_handler);
         }
 
-        if (regions.length() > 0) {
-            callrate_handler.reset(new RCallRateHandler(ss, parse_regions(regions)));
-            parser.register_handler(callrate_handler);
+        if (ret_counts[0]) {
+            counts_handler.reset(new RGenotypeCountsHandler(ss));
         }
 
         if (binary_prefix.length() > 0) {
             string prefix = string(binary_prefix[0]);
             binary_handler.reset(new BinaryFileHandler(ss, prefix + "_bin", prefix + "_meta"));
-            parser.register_handler(binary_handler);
         }
+        parser.register_handler(compose(ss, gmatrix_handler, counts_handler, binary_handler));
 
         parser.parse_genotypes();
+        warn(parser.diagnostics());
         ret["samples"] = CharacterVector(ss.begin(), ss.end());
+        ret["errors"] = summary(parser.diagnostics());
         if (ret_gmatrix[0]) {
             ret["genotype"] = gmatrix_handler->result();
         }
-        if (regions.length() > 0) {
-            ret["callrate"] = callrate_handler->result();
+        if (ret_counts[0]) {
+            ret["counts"] = counts_handler->result();
+        }
+    } catch (ParserException& e) {
+        ::Rf_error(e.get_message().c_str());
+    }
+    return ret;
+}
+
+// [[Rcpp::export]]
+List harmonize_plink(const CharacterVector& bfile, const CharacterVector& positions,
+                     const CharacterVector& refs, const CharacterVector& alts) {
+    List ret;
+    try {
+        shared_ptr<AlleleHarmonizer> harmonizer(new AlleleHarmonizer());
+        for (int i = 0; i < positions.length(); i++) {
+            harmonizer->add(Variant(Position::parse_position(string(positions[i])),
+                                    string(refs[i]), string(alts[i])));
         }
+        CharacterVector none;
+        PlinkParser parser(string(bfile[0]), filter(none, none, none, 0, 0));
+        parser.set_reference(harmonizer);
+        parser.parse_header();
+        auto ss = parser.sample_names();
+        shared_ptr<RGenotypeMatrixHandler> gmatrix_handler(new RGenotypeMatrixHandler(ss));
+        shared_ptr<RGenotypeCountsHandler> counts_handler(new RGenotypeCountsHandler(ss));
+        parser.register_handler(compose(ss, gmatrix_handler, counts_handler));
+        parser.parse_genotypes();
+        warn(parser.diagnostics());
+
+        const auto& counts = harmonizer->counts();
+        IntegerVector summary(counts.begin(), counts.end());
+        summary.attr("names") = CharacterVector::create("match", "swap", "mismatch", "duplicate", "absent");
+        vector<string> mismatches;
+        for (const Variant& v: harmonizer->mismatched()) {
+            mismatches.push_back((string)v);
+        }
+        ret["samples"] = CharacterVector(ss.begin(), ss.end());
+        ret["genotype"] = gmatrix_handler->result();
+        ret["counts"] = counts_handler->result();
+        ret["summary"] = summary;
+        ret["mismatches"] = CharacterVector(mismatches.begin(), mismatches.end());
     } catch (ParserException& e) {
         ::Rf_error(e.get_message().c_str());
     }
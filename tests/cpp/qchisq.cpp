@@ -0,0 +1,29 @@
+// Reads numbers from standard input and prints their upper chi-square
+// quantiles ("q") or upper tail probabilities ("p") with one degree of
+// freedom, one per line.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "qchisq.h"
+
+int main(int argc, char** argv) {
+    if (argc != 2 || (std::strcmp(argv[1], "q") != 0 && std::strcmp(argv[1], "p") != 0)) {
+        std::fprintf(stderr, "usage: %s q|p < numbers\n", argv[0]);
+        return 2;
+    }
+    std::vector<double> values;
+    double value;
+    while (std::scanf("%lf", &value) == 1) {
+        values.push_back(value);
+    }
+    if (argv[1][0] == 'q') {
+        qchisq_upper(values.data(), values.size(), values.data());
+    } else {
+        pchisq_upper(values.data(), values.size(), values.data());
+    }
+    for (double v: values) {
+        std::printf("%.17g\n", v);
+    }
+    return 0;
+}
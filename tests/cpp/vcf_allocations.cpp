@@ -0,0 +1,66 @@
+// Reads a VCF file from standard input, parses its variant lines twice in a
+// row with one parser and prints the number of memory allocations made in
+// each pass, then the number of lines skipped because of errors. Arguments
+// are the samples to keep, all samples are kept without them.
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "vcf_parser.h"
+
+namespace {
+    unsigned long allocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+int main(int argc, char** argv) {
+    std::string header;
+    std::string body;
+    std::string line;
+    unsigned long n_lines = 0;
+    while (std::getline(std::cin, line)) {
+        if (line.compare(0, 1, "#") == 0) {
+            header += line + "\n";
+        } else {
+            body += line + "\n";
+            ++n_lines;
+        }
+    }
+    std::stringstream input;
+    input << header << body << body;
+
+    vcf::VCFFilter filter(0, 0);
+    if (argc > 1) {
+        std::vector<std::string> samples(argv + 1, argv + argc);
+        filter.add_samples(samples);
+    }
+    vcf::VCFParser parser(input, filter);
+    parser.parse_header();
+    parser.register_handler(std::make_shared<vcf::VariantsHandler>(parser.sample_names()));
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned long before = allocations;
+        for (unsigned long i = 0; i < n_lines; i++) {
+            parser.parse_line();
+        }
+        std::printf("%lu\n", allocations - before);
+    }
+    std::printf("%lu\n", parser.diagnostics().total());
+    return 0;
+}